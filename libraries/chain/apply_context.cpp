@@ -29,7 +29,29 @@ static inline void print_debug(account_name receiver, const action_trace& ar) {
    }
 }
 
-action_trace apply_context::exec_one()
+apply_context::apply_context(controller& con, transaction_context& trx_ctx, action_trace& t, uint32_t depth)
+:control(con)
+,db(con.db())
+,trx_context(trx_ctx)
+,act(t.act)
+,receiver(act.account)
+,used_authorizations(act.authorization.size(), false, trx_ctx.arena)
+,recurse_depth(depth)
+,idx64(*this, trx_ctx.arena)
+,idx128(*this, trx_ctx.arena)
+,idx256(*this, trx_ctx.arena)
+,idx_double(*this, trx_ctx.arena)
+,idx_long_double(*this, trx_ctx.arena)
+,trace(t)
+,keyval_cache(trx_ctx.arena)
+,_notified(trx_ctx.arena)
+,_inline_actions(trx_ctx.arena)
+,_cfa_inline_actions(trx_ctx.arena)
+{
+   reset_console();
+}
+
+void apply_context::exec_one( action_trace& t )
 {
    auto start = fc::time_point::now();
 
@@ -62,7 +84,7 @@ action_trace apply_context::exec_one()
 
    action_receipt r;
    r.receiver         = receiver;
-   r.act_digest       = digest_type::hash(act);
+   r.act_digest       = act_digest();
    r.global_sequence  = next_global_sequence();
    r.recv_sequence    = next_recv_sequence( receiver );
 
@@ -74,9 +96,8 @@ action_trace apply_context::exec_one()
       r.auth_sequence[auth.actor] = next_auth_sequence( auth.actor );
    }
 
-   action_trace t(r);
+   t.receipt = r;
    t.trx_id = trx_context.id;
-   t.act = act;
    t.console = _pending_console_output.str();
 
    trx_context.executed.emplace_back( move(r) );
@@ -88,16 +109,25 @@ action_trace apply_context::exec_one()
    reset_console();
 
    t.elapsed = fc::time_point::now() - start;
-   return t;
+}
+
+const digest_type& apply_context::act_digest() {
+   if( !_act_digest )
+      _act_digest = digest_type::hash(act);
+   return *_act_digest;
 }
 
 void apply_context::exec()
 {
    _notified.push_back(receiver);
-   trace = exec_one();
+   exec_one( trace );
    for( uint32_t i = 1; i < _notified.size(); ++i ) {
       receiver = _notified[i];
-      trace.inline_traces.emplace_back( exec_one() );
+      // every notification trace needs its own copy of the action, the payload of the original stays in place
+      action_trace t;
+      t.act = act;
+      exec_one( t );
+      trace.inline_traces.emplace_back( move(t) );
    }
 
    if( _cfa_inline_actions.size() > 0 || _inline_actions.size() > 0 ) {
@@ -105,14 +135,15 @@ void apply_context::exec()
                   transaction_exception, "inline action recursion depth reached" );
    }
 
-   for( const auto& inline_action : _cfa_inline_actions ) {
+   // queued inline actions are not needed after dispatch, so their payloads are moved into the traces they execute from
+   for( auto& inline_action : _cfa_inline_actions ) {
       trace.inline_traces.emplace_back();
-      trx_context.dispatch_action( trace.inline_traces.back(), inline_action, inline_action.account, true, recurse_depth + 1 );
+      trx_context.dispatch_action( trace.inline_traces.back(), move(inline_action), true, recurse_depth + 1 );
    }
 
-   for( const auto& inline_action : _inline_actions ) {
+   for( auto& inline_action : _inline_actions ) {
       trace.inline_traces.emplace_back();
-      trx_context.dispatch_action( trace.inline_traces.back(), inline_action, inline_action.account, false, recurse_depth + 1 );
+      trx_context.dispatch_action( trace.inline_traces.back(), move(inline_action), false, recurse_depth + 1 );
    }
 
 } /// exec()
@@ -3,6 +3,7 @@
 
 #include <eosio/chain/block_log.hpp>
 #include <eosio/chain/fork_database.hpp>
+#include <eosio/chain/unapplied_transaction_queue.hpp>
 #include <eosio/chain/exceptions.hpp>
 
 #include <eosio/chain/account_object.hpp>
@@ -115,7 +116,13 @@ struct controller_impl {
     *  are removed from this list if they are re-applied in other blocks. Producers
     *  can query this list when scheduling new transactions into blocks.
     */
-   map<digest_type, transaction_metadata_ptr>     unapplied_transactions;
+   unapplied_transaction_queue                    unapplied_transactions;
+
+   /**
+    *  Head block committed by commit_block_before_signing whose signature is still being produced. It is
+    *  kept out of the reversible block database and hidden from fetch_block_by_* until it is signed.
+    */
+   block_state_ptr                                unsigned_head;
 
    void pop_block() {
       auto prev = fork_db.get_block( head->header.previous );
@@ -128,7 +135,7 @@ struct controller_impl {
 
       if ( read_mode == db_read_mode::SPECULATIVE ) {
          for( const auto& t : head->trxs )
-            unapplied_transactions[t->signed_id] = t;
+            unapplied_transactions.add( t );
       }
       head = prev;
       db.undo();
@@ -150,7 +157,7 @@ struct controller_impl {
         cfg.reversible_cache_size ),
     blog( cfg.blocks_dir ),
     fork_db( cfg.state_dir ),
-    wasmif( cfg.wasm_runtime ),
+    wasmif( cfg.wasm_runtime, cfg.wasm_profiling ),
     resource_limits( db ),
     authorization( s, db ),
     conf( cfg ),
@@ -465,28 +472,29 @@ struct controller_impl {
    /**
     * @post regardless of the success of commit block there is no active pending block
     */
-   void commit_block( bool add_to_fork_db ) {
+   void commit_block( bool add_to_fork_db, bool signature_pending = false ) {
       auto reset_pending_on_exit = fc::make_scoped_exit([this]{
          pending.reset();
       });
 
       try {
+         EOS_ASSERT( !unsigned_head, block_validate_exception, "it is not valid to commit a block while the head block awaits its signature" );
+
          if (add_to_fork_db) {
             pending->_pending_block_state->validated = true;
             auto new_bsp = fork_db.add(pending->_pending_block_state);
-            emit(self.accepted_block_header, pending->_pending_block_state);
+            if( !signature_pending )
+               emit(self.accepted_block_header, pending->_pending_block_state);
             head = fork_db.head();
             EOS_ASSERT(new_bsp == head, fork_database_exception, "committed block did not become the new head in fork database");
          }
 
-         if( !replaying ) {
-            reversible_blocks.create<reversible_block_object>( [&]( auto& ubo ) {
-               ubo.blocknum = pending->_pending_block_state->block_num;
-               ubo.set_block( pending->_pending_block_state->block );
-            });
+         if( signature_pending ) {
+            // stored and announced by complete_block_signature
+            unsigned_head = pending->_pending_block_state;
+         } else {
+            store_reversible_and_emit( pending->_pending_block_state );
          }
-
-         emit( self.accepted_block, pending->_pending_block_state );
       } catch (...) {
          // dont bother resetting pending, instead abort the block
          reset_pending_on_exit.cancel();
@@ -498,6 +506,41 @@ struct controller_impl {
       pending->push();
    }
 
+   void store_reversible_and_emit( const block_state_ptr& bsp ) {
+      if( !replaying ) {
+         reversible_blocks.create<reversible_block_object>( [&]( auto& ubo ) {
+            ubo.blocknum = bsp->block_num;
+            ubo.set_block( bsp->block );
+         });
+      }
+
+      emit( self.accepted_block, bsp );
+   }
+
+   void complete_block_signature( const signature_type& sig ) {
+      EOS_ASSERT( unsigned_head, block_validate_exception, "no block is awaiting a signature" );
+      auto bsp = unsigned_head;
+
+      EOS_ASSERT( bsp->block_signing_key == fc::crypto::public_key( sig, bsp->sig_digest() ), wrong_signing_key, "block is signed with unexpected key" );
+      bsp->header.producer_signature = sig;
+      static_cast<signed_block_header&>(*bsp->block) = bsp->header;
+      unsigned_head.reset();
+
+      emit( self.accepted_block_header, bsp );
+      store_reversible_and_emit( bsp );
+   }
+
+   void discard_unsigned_block() {
+      EOS_ASSERT( unsigned_head, block_validate_exception, "no block is awaiting a signature" );
+      auto bsp = unsigned_head;
+      EOS_ASSERT( head == bsp, block_validate_exception, "block awaiting a signature is no longer the head block" );
+
+      abort_block();
+      unsigned_head.reset();
+      pop_block();
+      fork_db.remove( bsp->id );
+   }
+
    // The returned scoped_exit should not exceed the lifetime of the pending which existed when make_block_restore_point was called.
    fc::scoped_exit<std::function<void()>> make_block_restore_point() {
       auto orig_block_transactions_size = pending->_pending_block_state->block->transactions.size();
@@ -1017,6 +1060,7 @@ struct controller_impl {
    void push_block( const signed_block_ptr& b, controller::block_status s ) {
     //  idump((fc::json::to_pretty_string(*b)));
       EOS_ASSERT(!pending, block_validate_exception, "it is not valid to push a block when there is a pending block");
+      EOS_ASSERT(!unsigned_head, block_validate_exception, "it is not valid to push a block while the head block awaits its signature");
       try {
          EOS_ASSERT( b, block_validate_exception, "trying to push empty block" );
          EOS_ASSERT( s != controller::block_status::incomplete, block_validate_exception, "invalid block status for a completed block" );
@@ -1111,7 +1155,7 @@ struct controller_impl {
       if( pending ) {
          if ( read_mode == db_read_mode::SPECULATIVE ) {
             for( const auto& t : pending->_pending_block_state->trxs )
-               unapplied_transactions[t->signed_id] = t;
+               unapplied_transactions.add( t );
          }
          pending.reset();
       }
@@ -1403,6 +1447,24 @@ void controller::commit_block() {
    my->commit_block(true);
 }
 
+void controller::commit_block_before_signing() {
+   validate_db_available_size();
+   validate_reversible_available_size();
+   my->commit_block(true, true);
+}
+
+void controller::complete_block_signature( const signature_type& sig ) {
+   my->complete_block_signature( sig );
+}
+
+void controller::discard_unsigned_block() {
+   my->discard_unsigned_block();
+}
+
+block_state_ptr controller::unsigned_head_block_state()const {
+   return my->unsigned_head;
+}
+
 void controller::abort_block() {
    my->abort_block();
 }
@@ -1541,7 +1603,7 @@ const global_property_object& controller::get_global_properties()const {
 
 signed_block_ptr controller::fetch_block_by_id( block_id_type id )const {
    auto state = my->fork_db.get_block(id);
-   if( state ) return state->block;
+   if( state ) return state != my->unsigned_head ? state->block : signed_block_ptr();
    auto bptr = fetch_block_by_number( block_header::num_from_id(id) );
    if( bptr && bptr->id() == id ) return bptr;
    return signed_block_ptr();
@@ -1550,7 +1612,7 @@ signed_block_ptr controller::fetch_block_by_id( block_id_type id )const {
 signed_block_ptr controller::fetch_block_by_number( uint32_t block_num )const  { try {
    auto blk_state = my->fork_db.get_block_in_current_chain_by_num( block_num );
    if( blk_state ) {
-      return blk_state->block;
+      return blk_state != my->unsigned_head ? blk_state->block : signed_block_ptr();
    }
 
    return my->blog.read_block_by_num(block_num);
@@ -1727,21 +1789,29 @@ const account_object& controller::get_account( account_name name )const
 
 vector<transaction_metadata_ptr> controller::get_unapplied_transactions() const {
    vector<transaction_metadata_ptr> result;
-   if ( my->read_mode == db_read_mode::SPECULATIVE ) {
-      result.reserve(my->unapplied_transactions.size());
-      for ( const auto& entry: my->unapplied_transactions ) {
-         result.emplace_back(entry.second);
-      }
-   } else {
-      EOS_ASSERT( my->unapplied_transactions.empty(), transaction_exception, "not empty unapplied_transactions in non-speculative mode" ); //should never happen
+   const auto& unapplied = get_unapplied_transaction_queue();
+   result.reserve(unapplied.size());
+   for ( const auto& entry: unapplied ) {
+      result.emplace_back(entry.trx_meta);
    }
    return result;
 }
 
+const unapplied_transaction_queue& controller::get_unapplied_transaction_queue() const {
+   if ( my->read_mode != db_read_mode::SPECULATIVE ) {
+      EOS_ASSERT( my->unapplied_transactions.empty(), transaction_exception, "not empty unapplied_transactions in non-speculative mode" ); //should never happen
+   }
+   return my->unapplied_transactions;
+}
+
 void controller::drop_unapplied_transaction(const transaction_metadata_ptr& trx) {
    my->unapplied_transactions.erase(trx->signed_id);
 }
 
+size_t controller::drop_expired_unapplied_transactions(fc::time_point pending_block_time) {
+   return my->unapplied_transactions.erase_expired(pending_block_time);
+}
+
 vector<transaction_id_type> controller::get_scheduled_transactions() const {
    const auto& idx = db().get_index<generated_transaction_multi_index,by_delay>();
 
@@ -1758,6 +1828,15 @@ vector<transaction_id_type> controller::get_scheduled_transactions() const {
    return result;
 }
 
+void controller::for_each_scheduled_transaction( const std::function<bool(const transaction_id_type&, const account_name& payer)>& f ) const {
+   const auto& idx = db().get_index<generated_transaction_multi_index,by_delay>();
+   const auto block_time = pending_block_time();
+
+   for( auto itr = idx.begin(); itr != idx.end() && itr->delay_until <= block_time; ++itr ) {
+      if( !f( itr->trx_id, itr->payer ) ) break;
+   }
+}
+
 void controller::check_contract_list( account_name code )const {
    my->check_contract_list( code );
 }
@@ -6,6 +6,7 @@
 #include <eosio/chain/controller.hpp>
 #include <eosio/chain/transaction.hpp>
 #include <eosio/chain/contract_table_objects.hpp>
+#include <eosio/chain/transaction_arena.hpp>
 #include <fc/utility.hpp>
 #include <sstream>
 #include <algorithm>
@@ -20,12 +21,28 @@ class transaction_context;
 
 class apply_context {
    private:
+      template<typename T>
+      using arena_vector = vector<T, arena_allocator<T>>;
+
+      template<typename K, typename V>
+      using arena_map = map<K, V, std::less<K>, arena_allocator<std::pair<const K, V>>>;
+
+   public:
+      /// Maps the objects and tables a contract accesses to the integer iterators of the db intrinsics
       template<typename T>
       class iterator_cache {
          public:
-            iterator_cache(){
+            iterator_cache( transaction_arena& arena )
+            :_table_cache(arena)
+            ,_end_iterator_to_table(arena)
+            ,_iterator_to_object(arena)
+            ,_iterator_to_id(arena)
+            ,_object_slots(arena)
+            ,_spare_object_slots(arena)
+            {
                _end_iterator_to_table.reserve(8);
                _iterator_to_object.reserve(32);
+               _iterator_to_id.reserve(32);
             }
 
             /// Returns end iterator of the table.
@@ -68,32 +85,105 @@ class apply_context {
                return *result;
             }
 
+            /// Called after the object was removed from the database, so it must not dereference it
             void remove( int iterator ) {
                EOS_ASSERT( iterator != -1, invalid_table_iterator, "invalid iterator" );
                EOS_ASSERT( iterator >= 0, table_operation_not_permitted, "cannot call remove on end iterators" );
                EOS_ASSERT( iterator < _iterator_to_object.size(), invalid_table_iterator, "iterator out of range" );
-               auto obj_ptr = _iterator_to_object[iterator];
-               if( !obj_ptr ) return;
+               if( !_iterator_to_object[iterator] ) return;
                _iterator_to_object[iterator] = nullptr;
-               _object_to_iterator.erase( obj_ptr );
+
+               const auto id = _iterator_to_id[iterator];
+               auto mask = _object_slots.size() - 1;
+               for( auto i = slot_for( id ); ; i = (i + 1) & mask ) {
+                  auto& slot = _object_slots[i];
+                  if( slot.iterator == freed_slot ) continue;
+                  EOS_ASSERT( slot.iterator != empty_slot, invalid_table_iterator, "an invariant was broken, object should be in cache" );
+                  if( slot.id != id ) continue;
+                  slot.iterator = freed_slot;
+                  --_live_object_slots;
+                  return;
+               }
             }
 
             int add( const T& obj ) {
-               auto itr = _object_to_iterator.find( &obj );
-               if( itr != _object_to_iterator.end() )
-                    return itr->second;
+               if( (_used_object_slots + 1) * 4 > _object_slots.size() * 3 )
+                  rehash_object_slots();
+
+               const auto id = obj.id._id;
+               auto mask = _object_slots.size() - 1;
+               object_slot* free_slot = nullptr;
+               for( auto i = slot_for( id ); ; i = (i + 1) & mask ) {
+                  auto& slot = _object_slots[i];
+                  if( slot.iterator == empty_slot ) {
+                     if( !free_slot ) {
+                        free_slot = &slot;
+                        ++_used_object_slots;
+                     }
+                     break;
+                  }
+                  if( slot.iterator == freed_slot ) {
+                     if( !free_slot ) free_slot = &slot;
+                     continue;
+                  }
+                  if( slot.id == id )
+                     return slot.iterator;
+               }
 
+               // iterators are never reused, so that stale iterators of removed objects keep failing
                _iterator_to_object.push_back( &obj );
-               _object_to_iterator[&obj] = _iterator_to_object.size() - 1;
+               _iterator_to_id.push_back( id );
+               free_slot->id       = id;
+               free_slot->iterator = _iterator_to_object.size() - 1;
+               ++_live_object_slots;
 
-               return _iterator_to_object.size() - 1;
+               return free_slot->iterator;
             }
 
          private:
-            map<table_id_object::id_type, pair<const table_id_object*, int>> _table_cache;
-            vector<const table_id_object*>                  _end_iterator_to_table;
-            vector<const T*>                                _iterator_to_object;
-            map<const T*,int>                               _object_to_iterator;
+            arena_map<table_id_object::id_type, pair<const table_id_object*, int>> _table_cache;
+            arena_vector<const table_id_object*>            _end_iterator_to_table;
+            arena_vector<const T*>                          _iterator_to_object;
+            arena_vector<int64_t>                           _iterator_to_id; ///< ids of _iterator_to_object, kept after removal
+
+            /**
+             *  Open addressed (linear probing) map from object id to iterator. Slots of removed objects are
+             *  marked freed and reused by later insertions; the table is rebuilt once used slots pass 3/4.
+             */
+            struct object_slot {
+               int64_t id;
+               int     iterator;
+            };
+            enum : int { empty_slot = -1, freed_slot = -2 };
+            static constexpr size_t min_object_slots = 32;
+
+            arena_vector<object_slot>                       _object_slots;
+            arena_vector<object_slot>                       _spare_object_slots; ///< storage recycled by rehash_object_slots
+            size_t                                          _live_object_slots = 0;
+            size_t                                          _used_object_slots = 0; ///< live plus freed slots
+
+            size_t slot_for( int64_t id )const {
+               return size_t( (uint64_t(id) * 0x9E3779B97F4A7C15ull) >> 32 ) & (_object_slots.size() - 1);
+            }
+
+            void rehash_object_slots() {
+               auto new_size = std::max( size_t(min_object_slots), _object_slots.size() );
+               while( (_live_object_slots + 1) * 2 > new_size )
+                  new_size *= 2;
+
+               _spare_object_slots.assign( new_size, object_slot{ 0, empty_slot } );
+               _spare_object_slots.swap( _object_slots );
+
+               auto mask = new_size - 1;
+               for( const auto& old : _spare_object_slots ) {
+                  if( old.iterator == empty_slot || old.iterator == freed_slot ) continue;
+                  auto i = slot_for( old.id );
+                  while( _object_slots[i].iterator != empty_slot )
+                     i = (i + 1) & mask;
+                  _object_slots[i] = old;
+               }
+               _used_object_slots = _live_object_slots;
+            }
 
             /// Precondition: std::numeric_limits<int>::min() < ei < -1
             /// Iterator of -1 is reserved for invalid iterators (i.e. when the appropriate table has not yet been created).
@@ -102,6 +192,7 @@ class apply_context {
             inline int index_to_end_iterator( size_t indx )const { return -(indx + 2); }
       }; /// class iterator_cache
 
+   private:
       template<typename>
       struct array_size;
 
@@ -174,7 +265,7 @@ class apply_context {
 
             using secondary_key_helper_t = secondary_key_helper<secondary_key_type, secondary_key_proxy_type, secondary_key_proxy_const_type>;
 
-            generic_index( apply_context& c ):context(c){}
+            generic_index( apply_context& c, transaction_arena& arena ):context(c),itr_cache(arena){}
 
             int store( uint64_t scope, uint64_t table, const account_name& payer,
                        uint64_t id, secondary_key_proxy_const_type value )
@@ -202,6 +293,7 @@ class apply_context {
                return itr_cache.add( obj );
             }
 
+            /// Called after the object was removed from the database, so it must not dereference it
             void remove( int iterator ) {
                const auto& obj = itr_cache.get( iterator );
                context.update_db_usage( obj.payer, -( config::billable_size_v<ObjectType> ) );
@@ -451,28 +543,14 @@ class apply_context {
 
    /// Constructor
    public:
-      apply_context(controller& con, transaction_context& trx_ctx, const action& a, uint32_t depth=0)
-      :control(con)
-      ,db(con.db())
-      ,trx_context(trx_ctx)
-      ,act(a)
-      ,receiver(act.account)
-      ,used_authorizations(act.authorization.size(), false)
-      ,recurse_depth(depth)
-      ,idx64(*this)
-      ,idx128(*this)
-      ,idx256(*this)
-      ,idx_double(*this)
-      ,idx_long_double(*this)
-      {
-         reset_console();
-      }
+      /// Executes the action stored in the trace, which receives the results of the execution
+      apply_context(controller& con, transaction_context& trx_ctx, action_trace& t, uint32_t depth=0);
 
 
    /// Execution methods:
    public:
 
-      action_trace exec_one();
+      void exec_one( action_trace& t );
       void exec();
       void execute_inline( action&& a );
       void execute_context_free_inline( action&& a );
@@ -568,6 +646,8 @@ class apply_context {
       vector<account_name> get_active_producers() const;
       bytes  get_packed_transaction();
 
+      const digest_type& act_digest();
+
       uint64_t next_global_sequence();
       uint64_t next_recv_sequence( account_name receiver );
       uint64_t next_auth_sequence( account_name actor );
@@ -584,9 +664,9 @@ class apply_context {
       controller&                   control;
       chainbase::database&          db;  ///< database where state is stored
       transaction_context&          trx_context; ///< transaction context in which the action is running
-      const action&                 act; ///< message being applied
+      const action&                 act; ///< message being applied, owned by trace
       account_name                  receiver; ///< the code that is currently running
-      vector<bool> used_authorizations; ///< Parallel to act.authorization; tracks which permissions have been used while processing the message
+      arena_vector<bool>            used_authorizations; ///< Parallel to act.authorization; tracks which permissions have been used while processing the message
       uint32_t                      recurse_depth; ///< how deep inline actions can recurse
       bool                          privileged   = false;
       bool                          context_free = false;
@@ -598,14 +678,15 @@ class apply_context {
       generic_index<index_double_object>                             idx_double;
       generic_index<index_long_double_object>                        idx_long_double;
 
-      action_trace                                trace;
+      action_trace&                               trace;
 
    private:
 
       iterator_cache<key_value_object>    keyval_cache;
-      vector<account_name>                _notified; ///< keeps track of new accounts to be notifed of current message
-      vector<action>                      _inline_actions; ///< queued inline messages
-      vector<action>                      _cfa_inline_actions; ///< queued inline messages
+      arena_vector<account_name>          _notified; ///< keeps track of new accounts to be notifed of current message
+      arena_vector<action>                _inline_actions; ///< queued inline messages
+      arena_vector<action>                _cfa_inline_actions; ///< queued inline messages
+      optional<digest_type>               _act_digest; ///< digest of act, shared by the receipts of all receivers
       std::ostringstream                  _pending_console_output;
 
       //bytes                               _cached_trx;
@@ -32,6 +32,7 @@ namespace eosio { namespace chain {
    using apply_handler = std::function<void(apply_context&)>;
 
    class fork_database;
+   class unapplied_transaction_queue;
 
    enum class db_read_mode {
       SPECULATIVE,
@@ -68,6 +69,7 @@ namespace eosio { namespace chain {
 
             genesis_state            genesis;
             wasm_interface::vm_type  wasm_runtime = chain::config::default_wasm_runtime;
+            bool                     wasm_profiling         =  false;
 
             db_read_mode             read_mode              = db_read_mode::SPECULATIVE;
             validation_mode          block_validation_mode  = validation_mode::FULL;
@@ -107,6 +109,15 @@ namespace eosio { namespace chain {
          vector<transaction_metadata_ptr> get_unapplied_transactions() const;
          void drop_unapplied_transaction(const transaction_metadata_ptr& trx);
 
+         /**
+          *  Same transactions as get_unapplied_transactions, in the order they were unapplied, without copying.
+          *  Pushing a transaction removes its entry if it succeeds, so advance past an entry before pushing it.
+          */
+         const unapplied_transaction_queue& get_unapplied_transaction_queue() const;
+
+         /// drops unapplied transactions that expire before pending_block_time, returns how many were dropped
+         size_t drop_expired_unapplied_transactions(fc::time_point pending_block_time);
+
          /**
           * These transaction IDs represent transactions available in the head chain state as scheduled
           * or otherwise generated transactions.
@@ -118,6 +129,13 @@ namespace eosio { namespace chain {
           */
          vector<transaction_id_type> get_scheduled_transactions() const;
 
+         /**
+          * Calls f with the id and payer of each transaction returned by get_scheduled_transactions, in the same
+          * order, until f returns false. Only the visited transactions are looked at, so callers that want a
+          * bounded number do not pay for the whole backlog. f must not modify the chain state.
+          */
+         void for_each_scheduled_transaction( const std::function<bool(const transaction_id_type&, const account_name& payer)>& f ) const;
+
          /**
           *
           */
@@ -132,6 +150,18 @@ namespace eosio { namespace chain {
          void finalize_block();
          void sign_block( const std::function<signature_type( const digest_type& )>& signer_callback );
          void commit_block();
+
+         /**
+          *  Pipelined alternative to sign_block followed by commit_block: the finalized block becomes the head
+          *  right away, so the next block can be started while its signature is produced elsewhere. Until
+          *  complete_block_signature is called the block is not stored in the reversible block database, is not
+          *  returned by fetch_block_by_*, no block signals are emitted for it and no other block may be pushed or
+          *  committed. discard_unsigned_block pops it (and any pending block) if it cannot be signed.
+          */
+         void commit_block_before_signing();
+         void complete_block_signature( const signature_type& sig );
+         void discard_unsigned_block();
+         block_state_ptr unsigned_head_block_state()const;
          void pop_block();
 
          void push_block( const signed_block_ptr& b, block_status s = block_status::complete );
@@ -300,5 +330,6 @@ FC_REFLECT( eosio::chain::controller::config,
             (contracts_console)
             (genesis)
             (wasm_runtime)
+            (wasm_profiling)
             (resource_greylist)
           )
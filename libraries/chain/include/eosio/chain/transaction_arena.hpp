@@ -0,0 +1,92 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <vector>
+
+namespace eosio { namespace chain {
+
+   /**
+    *  Monotonic memory arena for short lived objects created while a transaction executes.
+    *
+    *  Memory is handed out by bumping a pointer through fixed size chunks; deallocation is a no-op and
+    *  everything is released at once when the arena is reset or destroyed. Released chunks are kept on a
+    *  small free list shared by all arenas of the thread, so steady state transaction processing does not
+    *  touch malloc for these allocations at all.
+    *
+    *  Nothing allocated from an arena may outlive the transaction_context that owns it.
+    */
+   class transaction_arena {
+      public:
+         static constexpr size_t chunk_size      = 64*1024;
+         static constexpr size_t max_free_chunks = 16;
+
+         transaction_arena() = default;
+         ~transaction_arena() { reset(); }
+
+         transaction_arena( const transaction_arena& ) = delete;
+         transaction_arena& operator=( const transaction_arena& ) = delete;
+
+         void* allocate( size_t size, size_t alignment );
+
+         /// Releases every allocation made from this arena
+         void reset();
+
+         /// Total bytes handed out since the last reset (excluding alignment padding)
+         size_t bytes_allocated()const { return _bytes_allocated; }
+
+      private:
+         struct chunk {
+            char*  data;
+            size_t size;
+         };
+
+         void new_chunk( size_t min_size );
+
+         static std::vector<char*>& free_chunks();
+
+         std::vector<chunk> _chunks;
+         char*              _pos = nullptr;
+         char*              _end = nullptr;
+         size_t             _bytes_allocated = 0;
+   };
+
+   /**
+    *  Standard allocator adaptor that carves allocations out of a transaction_arena, for use by the
+    *  containers of apply_context and transaction_context which are discarded with the transaction.
+    */
+   template<typename T>
+   class arena_allocator {
+      public:
+         typedef T value_type;
+
+         arena_allocator( transaction_arena& a ) : _arena(&a) {}
+
+         template<typename U>
+         arena_allocator( const arena_allocator<U>& other ) : _arena(other.arena()) {}
+
+         T* allocate( size_t n ) {
+            if( n > std::numeric_limits<size_t>::max() / sizeof(T) )
+               throw std::bad_alloc();
+            return static_cast<T*>( _arena->allocate( n * sizeof(T), alignof(T) ) );
+         }
+
+         void deallocate( T*, size_t ) {}
+
+         transaction_arena* arena()const { return _arena; }
+
+         template<typename U>
+         bool operator==( const arena_allocator<U>& other )const { return _arena == other.arena(); }
+         template<typename U>
+         bool operator!=( const arena_allocator<U>& other )const { return _arena != other.arena(); }
+
+      private:
+         transaction_arena* _arena;
+   };
+
+} } /// eosio::chain
@@ -1,6 +1,7 @@
 #pragma once
 #include <eosio/chain/controller.hpp>
 #include <eosio/chain/trace.hpp>
+#include <eosio/chain/transaction_arena.hpp>
 
 namespace eosio { namespace chain {
 
@@ -53,6 +54,9 @@ namespace eosio { namespace chain {
          inline void dispatch_action( action_trace& trace, const action& a, bool context_free = false ) {
             dispatch_action(trace, a, a.account, context_free);
          };
+         /// Moves the action into the trace and executes it from there, avoiding a copy of its payload
+         void dispatch_action( action_trace& trace, action&& a, bool context_free, uint32_t recurse_depth );
+         void execute_action( action_trace& trace, account_name receiver, bool context_free, uint32_t recurse_depth );
          void schedule_transaction();
          void record_transaction( const transaction_id_type& id, fc::time_point_sec expire );
 
@@ -61,6 +65,9 @@ namespace eosio { namespace chain {
       /// Fields:
       public:
 
+         /// backs the temporary containers of the apply_contexts of this transaction, released with the transaction
+         transaction_arena             arena;
+
          controller&                   control;
          const signed_transaction&     trx;
          transaction_id_type           id;
@@ -0,0 +1,98 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/chain/transaction_metadata.hpp>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/mem_fun.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+
+namespace eosio { namespace chain {
+
+   struct unapplied_transaction {
+      transaction_metadata_ptr trx_meta;
+      fc::time_point           expiry;
+      uint64_t                 arrival = 0;
+
+      const transaction_id_type& id()const        { return trx_meta->id; }
+      const digest_type&         signed_id()const { return trx_meta->signed_id; }
+   };
+
+   /**
+    *  Transactions that were undone by pop_block or abort_block and may be re-applied by a producer.
+    *
+    *  Entries are indexed by signed id (for removal when a transaction is applied), by transaction id (for
+    *  lookups of persisted transactions), by expiry (so expired transactions are dropped as a range) and
+    *  by arrival, which is the order they are iterated in. Iteration does not copy; erasing an entry only
+    *  invalidates iterators to that entry, so callers that push the transaction they are looking at must
+    *  advance their iterator first.
+    */
+   class unapplied_transaction_queue {
+      public:
+         struct by_signed_id;
+         struct by_trx_id;
+         struct by_expiry;
+         struct by_arrival;
+
+         typedef boost::multi_index_container<
+            unapplied_transaction,
+            boost::multi_index::indexed_by<
+               boost::multi_index::ordered_unique< boost::multi_index::tag<by_arrival>,
+                  boost::multi_index::member<unapplied_transaction, uint64_t, &unapplied_transaction::arrival> >,
+               boost::multi_index::hashed_unique< boost::multi_index::tag<by_signed_id>,
+                  boost::multi_index::const_mem_fun<unapplied_transaction, const digest_type&, &unapplied_transaction::signed_id>,
+                  std::hash<digest_type> >,
+               boost::multi_index::hashed_non_unique< boost::multi_index::tag<by_trx_id>,
+                  boost::multi_index::const_mem_fun<unapplied_transaction, const transaction_id_type&, &unapplied_transaction::id>,
+                  std::hash<transaction_id_type> >,
+               boost::multi_index::ordered_non_unique< boost::multi_index::tag<by_expiry>,
+                  boost::multi_index::member<unapplied_transaction, fc::time_point, &unapplied_transaction::expiry> >
+            >
+         > index_type;
+
+         typedef index_type::index<by_arrival>::type::const_iterator iterator;
+
+         bool   empty()const { return _queue.empty(); }
+         size_t size()const  { return _queue.size(); }
+
+         /// In arrival order
+         iterator begin()const { return _queue.get<by_arrival>().begin(); }
+         iterator end()const   { return _queue.get<by_arrival>().end(); }
+
+         transaction_metadata_ptr find( const transaction_id_type& id )const {
+            const auto& idx = _queue.get<by_trx_id>();
+            auto itr = idx.find( id );
+            return itr != idx.end() ? itr->trx_meta : transaction_metadata_ptr();
+         }
+
+         /// Keeps the original arrival of transactions already queued
+         bool add( const transaction_metadata_ptr& trx ) {
+            return _queue.insert( unapplied_transaction{ trx, trx->packed_trx.expiration(), _next_arrival++ } ).second;
+         }
+
+         bool erase( const digest_type& signed_id ) {
+            return _queue.get<by_signed_id>().erase( signed_id ) > 0;
+         }
+
+         /// Drops every transaction that expires before time
+         size_t erase_expired( fc::time_point time ) {
+            auto& idx = _queue.get<by_expiry>();
+            auto end = idx.lower_bound( time );
+            auto count = std::distance( idx.begin(), end );
+            idx.erase( idx.begin(), end );
+            return count;
+         }
+
+         void clear() { _queue.clear(); }
+
+      private:
+         index_type _queue;
+         uint64_t   _next_arrival = 0;
+   };
+
+} } /// eosio::chain
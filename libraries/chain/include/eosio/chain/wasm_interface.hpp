@@ -56,7 +56,8 @@ namespace eosio { namespace chain {
             binaryen,
          };
 
-         wasm_interface(vm_type vm);
+         //profiling writes symbol maps of JIT compiled contract code for external profilers (wavm only)
+         wasm_interface(vm_type vm, bool profiling = false);
          ~wasm_interface();
 
          //validates code -- does a WASM validation pass and checks the wasm against EOSIO specific constraints
@@ -23,9 +23,9 @@ using namespace Runtime;
 namespace eosio { namespace chain {
 
    struct wasm_interface_impl {
-      wasm_interface_impl(wasm_interface::vm_type vm) {
+      wasm_interface_impl(wasm_interface::vm_type vm, bool profiling) {
          if(vm == wasm_interface::vm_type::wavm)
-            runtime_interface = std::make_unique<webassembly::wavm::wavm_runtime>();
+            runtime_interface = std::make_unique<webassembly::wavm::wavm_runtime>(profiling);
          else if(vm == wasm_interface::vm_type::binaryen)
             runtime_interface = std::make_unique<webassembly::binaryen::binaryen_runtime>();
          else
@@ -52,6 +52,7 @@ namespace eosio { namespace chain {
 
       std::unique_ptr<wasm_instantiated_module_interface>& get_instantiated_module( const digest_type& code_id,
                                                                                     const shared_string& code,
+                                                                                    account_name receiver,
                                                                                     transaction_context& trx_context )
       {
          auto it = instantiation_cache.find(code_id);
@@ -84,7 +85,9 @@ namespace eosio { namespace chain {
             } catch(const IR::ValidationException& e) {
                EOS_ASSERT(false, wasm_serialization_error, e.message.c_str());
             }
-            it = instantiation_cache.emplace(code_id, runtime_interface->instantiate_module((const char*)bytes.data(), bytes.size(), parse_initial_memory(module))).first;
+            //a module is named after the first account it is run for; accounts sharing identical code share the module
+            it = instantiation_cache.emplace(code_id, runtime_interface->instantiate_module((const char*)bytes.data(), bytes.size(), parse_initial_memory(module),
+                                                                                            receiver.to_string())).first;
          }
          return it->second;
       }
@@ -17,9 +17,10 @@ using namespace eosio::chain::webassembly::common;
 
 class wavm_runtime : public eosio::chain::wasm_runtime_interface {
    public:
-      wavm_runtime();
+      wavm_runtime(bool profiling = false);
       ~wavm_runtime();
-      std::unique_ptr<wasm_instantiated_module_interface> instantiate_module(const char* code_bytes, size_t code_size, std::vector<uint8_t> initial_memory) override;
+      std::unique_ptr<wasm_instantiated_module_interface> instantiate_module(const char* code_bytes, size_t code_size, std::vector<uint8_t> initial_memory,
+                                                                             const std::string& debug_name) override;
 
       struct runtime_guard {
          runtime_guard();
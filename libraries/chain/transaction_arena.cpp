@@ -0,0 +1,74 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/chain/transaction_arena.hpp>
+#include <algorithm>
+#include <cstdlib>
+
+namespace eosio { namespace chain {
+
+   constexpr size_t transaction_arena::chunk_size;
+   constexpr size_t transaction_arena::max_free_chunks;
+
+   std::vector<char*>& transaction_arena::free_chunks() {
+      struct chunk_list {
+         std::vector<char*> chunks;
+         ~chunk_list() {
+            for( auto c : chunks )
+               std::free( c );
+         }
+      };
+      static thread_local chunk_list list;
+      return list.chunks;
+   }
+
+   void* transaction_arena::allocate( size_t size, size_t alignment ) {
+      auto aligned = [&]( char* p ) {
+         return reinterpret_cast<char*>( (reinterpret_cast<uintptr_t>(p) + alignment - 1) & ~(uintptr_t(alignment) - 1) );
+      };
+
+      char* p = aligned( _pos );
+      if( !_pos || p + size > _end ) {
+         new_chunk( size + alignment );
+         p = aligned( _pos );
+      }
+
+      _pos = p + size;
+      _bytes_allocated += size;
+      return p;
+   }
+
+   void transaction_arena::new_chunk( size_t min_size ) {
+      chunk c{ nullptr, std::max( chunk_size, min_size ) };
+
+      auto& free_list = free_chunks();
+      if( c.size == chunk_size && !free_list.empty() ) {
+         c.data = free_list.back();
+         free_list.pop_back();
+      } else {
+         c.data = static_cast<char*>( std::malloc( c.size ) );
+         if( !c.data ) throw std::bad_alloc();
+      }
+
+      _chunks.push_back( c );
+      _pos = c.data;
+      _end = c.data + c.size;
+   }
+
+   void transaction_arena::reset() {
+      auto& free_list = free_chunks();
+      for( const auto& c : _chunks ) {
+         // oversized chunks are returned to the system, regular ones are recycled by the next transaction
+         if( c.size == chunk_size && free_list.size() < max_free_chunks )
+            free_list.push_back( c.data );
+         else
+            std::free( c.data );
+      }
+      _chunks.clear();
+      _pos = nullptr;
+      _end = nullptr;
+      _bytes_allocated = 0;
+   }
+
+} } /// eosio::chain
@@ -401,18 +401,21 @@ namespace eosio { namespace chain {
    }
 
    void transaction_context::dispatch_action( action_trace& trace, const action& a, account_name receiver, bool context_free, uint32_t recurse_depth ) {
-      apply_context  acontext( control, *this, a, recurse_depth );
+      trace.act = a;
+      execute_action( trace, receiver, context_free, recurse_depth );
+   }
+
+   void transaction_context::dispatch_action( action_trace& trace, action&& a, bool context_free, uint32_t recurse_depth ) {
+      trace.act = move(a);
+      execute_action( trace, trace.act.account, context_free, recurse_depth );
+   }
+
+   void transaction_context::execute_action( action_trace& trace, account_name receiver, bool context_free, uint32_t recurse_depth ) {
+      apply_context  acontext( control, *this, trace, recurse_depth );
       acontext.context_free = context_free;
       acontext.receiver     = receiver;
 
-      try {
-         acontext.exec();
-      } catch( ... ) {
-         trace = move(acontext.trace);
-         throw;
-      }
-
-      trace = move(acontext.trace);
+      acontext.exec();
    }
 
    void transaction_context::schedule_transaction() {
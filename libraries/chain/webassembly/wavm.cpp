@@ -95,8 +95,11 @@ wavm_runtime::runtime_guard::~runtime_guard() {
 static weak_ptr<wavm_runtime::runtime_guard> __runtime_guard_ptr;
 static std::mutex __runtime_guard_lock;
 
-wavm_runtime::wavm_runtime() {
+wavm_runtime::wavm_runtime(bool profiling) {
    std::lock_guard<std::mutex> l(__runtime_guard_lock);
+   //the perf map has to be enabled before any module is compiled, it then stays enabled for the life of the process
+   if(profiling)
+      Runtime::setPerfMapEnabled(true);
    if (__runtime_guard_ptr.use_count() == 0) {
       _runtime_guard = std::make_shared<runtime_guard>();
       __runtime_guard_ptr = _runtime_guard;
@@ -108,7 +111,8 @@ wavm_runtime::wavm_runtime() {
 wavm_runtime::~wavm_runtime() {
 }
 
-std::unique_ptr<wasm_instantiated_module_interface> wavm_runtime::instantiate_module(const char* code_bytes, size_t code_size, std::vector<uint8_t> initial_memory) {
+std::unique_ptr<wasm_instantiated_module_interface> wavm_runtime::instantiate_module(const char* code_bytes, size_t code_size, std::vector<uint8_t> initial_memory,
+                                                                                     const std::string& debug_name) {
    std::unique_ptr<Module> module = std::make_unique<Module>();
    try {
       Serialization::MemoryInputStream stream((const U8*)code_bytes, code_size);
@@ -121,7 +125,7 @@ std::unique_ptr<wasm_instantiated_module_interface> wavm_runtime::instantiate_mo
 
    eosio::chain::webassembly::common::root_resolver resolver;
    LinkResult link_result = linkModule(*module, resolver);
-   ModuleInstance *instance = instantiateModule(*module, std::move(link_result.resolvedImports));
+   ModuleInstance *instance = instantiateModule(*module, std::move(link_result.resolvedImports), debug_name);
    EOS_ASSERT(instance != nullptr, wasm_exception, "Fail to Instantiate WAVM Module");
 
    return std::make_unique<wavm_instantiated_module>(instance, std::move(module), initial_memory);
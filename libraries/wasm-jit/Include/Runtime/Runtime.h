@@ -16,6 +16,10 @@ namespace Runtime
 	// Initializes the runtime. Should only be called once per process.
 	RUNTIME_API void init();
 
+	// Enables writing a perf map (/tmp/perf-<pid>.map) describing the address range of every JIT compiled function,
+	// so that external profilers can symbolize WebAssembly frames. Only affects modules instantiated afterwards.
+	RUNTIME_API void setPerfMapEnabled(bool enabled);
+
 	// Information about a runtime exception.
 	struct Exception
 	{
@@ -203,7 +207,8 @@ namespace Runtime
 	};
 
 	// Instantiates a module, bindings its imports to the specified objects. May throw InstantiationException.
-	RUNTIME_API ModuleInstance* instantiateModule(const IR::Module& module,ImportBindings&& imports);
+	// The debug name is used to qualify the names of the module's functions in profiler symbol maps.
+	RUNTIME_API ModuleInstance* instantiateModule(const IR::Module& module,ImportBindings&& imports,const std::string& debugName = std::string());
 
 	// Gets the default table/memory for a ModuleInstance.
 	RUNTIME_API MemoryInstance* getDefaultMemory(ModuleInstance* moduleInstance);
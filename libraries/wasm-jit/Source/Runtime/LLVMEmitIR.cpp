@@ -1619,6 +1619,7 @@ namespace LLVMJIT
 			auto llvmFunctionType = asLLVMType(module.types[module.functions.defs[functionDefIndex].type.index]);
 			auto externalName = getExternalFunctionName(moduleInstance,functionDefIndex);
 			functionDefs[functionDefIndex] = llvm::Function::Create(llvmFunctionType,llvm::Function::ExternalLinkage,externalName,llvmModule);
+			if(perfMapEnabled) { functionDefs[functionDefIndex]->addFnAttr("no-frame-pointer-elim","true"); }
 		}
 
 		// Compile each function in the module.
@@ -25,6 +25,12 @@
 #include "llvm-c/Disassembler.h"
 #endif
 
+#include <cinttypes>
+#include <cstdio>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 namespace LLVMJIT
 {
 	llvm::LLVMContext context;
@@ -56,9 +62,38 @@ namespace LLVMJIT
 	Platform::Mutex* addressToSymbolMapMutex = Platform::createMutex();
 	std::map<Uptr,struct JITSymbol*> addressToSymbolMap;
 
+	// The perf map that JIT symbols are written to, if enabled. See setPerfMapEnabled.
+	bool perfMapEnabled = false;
+	Platform::Mutex* perfMapMutex = Platform::createMutex();
+	FILE* perfMapFile = nullptr;
+
 	// A map from function types to function indices in the invoke thunk unit.
 	std::map<const FunctionType*,struct JITSymbol*> invokeThunkTypeToSymbolMap;
 
+	void setPerfMapEnabled(bool enabled)
+	{
+		Platform::Lock perfMapLock(perfMapMutex);
+		perfMapEnabled = enabled;
+		#ifndef _WIN32
+			if(enabled && !perfMapFile)
+			{
+				// The perf tool looks for symbols of JIT compiled code in /tmp/perf-<pid>.map.
+				const std::string perfMapPath = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+				perfMapFile = fopen(perfMapPath.c_str(),"a");
+				if(!perfMapFile) { Log::printf(Log::Category::error,"Couldn't open perf map %s\n",perfMapPath.c_str()); }
+			}
+		#endif
+	}
+
+	// Appends a "<start> <size> <name>" line for a JIT symbol to the perf map.
+	static void writePerfMapEntry(Uptr baseAddress,Uptr numBytes,const std::string& name)
+	{
+		Platform::Lock perfMapLock(perfMapMutex);
+		if(!perfMapEnabled || !perfMapFile) { return; }
+		fprintf(perfMapFile,"%" PRIxPTR " %" PRIxPTR " %s\n",baseAddress,numBytes,name.c_str());
+		fflush(perfMapFile);
+	}
+
 	// Information about a JIT symbol, used to map instruction pointers to descriptive names.
 	struct JITSymbol
 	{
@@ -322,6 +357,14 @@ namespace LLVMJIT
 					Platform::Lock addressToSymbolMapLock(addressToSymbolMapMutex);
 					addressToSymbolMap[baseAddress + numBytes] = symbol;
 				}
+
+				// Qualify the function name with the module name, so profiles can be broken down per module.
+				if(perfMapEnabled)
+				{
+					writePerfMapEntry(baseAddress,numBytes,
+						(moduleInstance->debugName.size() ? moduleInstance->debugName : "<unnamed module>")
+						+ ":" + functionInstance->debugName);
+				}
 			}
 		}
 	};
@@ -343,6 +386,7 @@ namespace LLVMJIT
 				WAVM_ASSERT_THROW(!strcmp(name,"invokeThunk"));
 			#endif
 			symbol = new JITSymbol(functionType,baseAddress,numBytes,std::move(offsetToOpIndexMap));
+			if(perfMapEnabled) { writePerfMapEntry(baseAddress,numBytes,"<invoke thunk : " + asString(functionType) + ">"); }
 		}
 	};
 	
@@ -91,6 +91,9 @@ namespace LLVMJIT
 	// Zero constants of each type.
 	extern llvm::Constant* typedZeroConstants[(Uptr)ValueType::num];
 
+	// Whether JIT symbols are written to a perf map. Frame pointers are kept in this mode so profilers can unwind the stack.
+	extern bool perfMapEnabled;
+
 	// Converts a WebAssembly type to a LLVM type.
 	inline llvm::Type* asLLVMType(ValueType type) { return llvmResultTypes[(Uptr)asResultType(type)]; }
 	inline llvm::Type* asLLVMType(ResultType type) { return llvmResultTypes[(Uptr)type]; }
@@ -30,7 +30,7 @@ namespace Runtime
 
 	MemoryInstance* MemoryInstance::theMemoryInstance = nullptr;
 
-	ModuleInstance* instantiateModule(const IR::Module& module,ImportBindings&& imports)
+	ModuleInstance* instantiateModule(const IR::Module& module,ImportBindings&& imports,const std::string& debugName)
 	{
 		ModuleInstance* moduleInstance = new ModuleInstance(
 			std::move(imports.functions),
@@ -38,6 +38,7 @@ namespace Runtime
 			std::move(imports.memories),
 			std::move(imports.globals)
 			);
+		moduleInstance->debugName = debugName;
 		
 		// Get disassembly names for the module's objects.
 		DisassemblyNames disassemblyNames;
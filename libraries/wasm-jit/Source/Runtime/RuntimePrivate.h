@@ -21,6 +21,7 @@ namespace LLVMJIT
 
 	void init();
 	void instantiateModule(const IR::Module& module,Runtime::ModuleInstance* moduleInstance);
+	void setPerfMapEnabled(bool enabled);
 	bool describeInstructionPointer(Uptr ip,std::string& outDescription);
 	
 	typedef void (*InvokeFunctionPointer)(void*,U64*);
@@ -123,6 +124,8 @@ namespace Runtime
 
 		Uptr startFunctionIndex = UINTPTR_MAX;
 
+		std::string debugName;
+
 		ModuleInstance(
 			std::vector<FunctionInstance*>&& inFunctionImports,
 			std::vector<TableInstance*>&& inTableImports,
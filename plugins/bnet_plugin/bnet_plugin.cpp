@@ -256,6 +256,7 @@ namespace eosio {
         block_status_index        _block_status;
         transaction_status_index  _transaction_status;
         const uint32_t            _max_block_status_range = 2048; // limit tracked block_status known_by_peer
+        const uint32_t            _max_incoming_batch = 64; // messages read before received trxs are handed to the main thread
 
         public_key_type    _local_peer_id;
         uint32_t           _local_lib             = 0;
@@ -292,6 +293,12 @@ namespace eosio {
         boost::asio::io_service&                                       _app_ios;
 
         methods::get_block_by_number::method_type& _get_block_by_number;
+        incoming::methods::block_sync::method_type&        _incoming_block_sync;
+        incoming::methods::transaction_async::method_type& _incoming_transaction_async;
+
+        /// received on the session strand and not yet handed to the main thread, a block always ends a batch
+        vector<packed_transaction_ptr>                                _incoming_trxs;
+        signed_block_ptr                                              _incoming_block;
 
 
         string                                                         _peer;
@@ -320,7 +327,9 @@ namespace eosio {
          _ws( new ws::stream<tcp::socket>(move(socket)) ),
          _strand(_ws->get_executor() ),
          _app_ios( app().get_io_service() ),
-         _get_block_by_number( app().get_method<methods::get_block_by_number>() )
+         _get_block_by_number( app().get_method<methods::get_block_by_number>() ),
+         _incoming_block_sync( app().get_method<incoming::methods::block_sync>() ),
+         _incoming_transaction_async( app().get_method<incoming::methods::transaction_async>() )
         {
             _session_num = next_session_id();
             set_socket_options();
@@ -339,7 +348,9 @@ namespace eosio {
          _ws( new ws::stream<tcp::socket>(ioc) ),
          _strand( _ws->get_executor() ),
          _app_ios( app().get_io_service() ),
-         _get_block_by_number( app().get_method<methods::get_block_by_number>() )
+         _get_block_by_number( app().get_method<methods::get_block_by_number>() ),
+         _incoming_block_sync( app().get_method<incoming::methods::block_sync>() ),
+         _incoming_transaction_async( app().get_method<incoming::methods::transaction_async>() )
         {
            _session_num = next_session_id();
            _ws->binary(true);
@@ -891,7 +902,11 @@ namespace eosio {
               on_message( msg, ds );
               _in_buffer.consume( ds.tellp() );
 
-              wait_on_app();
+              if( !_incoming_block && _incoming_trxs.size() < _max_incoming_batch && next_message_arrived() ) {
+                 do_read();
+              } else {
+                 wait_on_app();
+              }
               return;
 
            } catch ( ... ) {
@@ -904,17 +919,41 @@ namespace eosio {
            }
         }
 
+        /// true if bytes of the next message are already waiting on the socket
+        bool next_message_arrived() {
+           boost::system::error_code ec;
+           return _ws->next_layer().available( ec ) > 0 && !ec;
+        }
+
         /** if we just call do_read here then this thread might run ahead of
          * the main thread, instead we post an event to main which will then
          * post a new read event when ready.
          *
+         * The transactions and block received since the last post are handed to
+         * the controller in that same event, in the order they were received.
+         *
          * This also keeps the "shared pointer" alive in the callback preventing
          * the connection from being closed.
          */
         void wait_on_app() {
-            app().get_io_service().post( 
-                boost::asio::bind_executor( _strand, [self=shared_from_this()]{ self->do_read(); } )
-            );
+            vector<packed_transaction_ptr> trxs;
+            trxs.swap( _incoming_trxs );
+            signed_block_ptr block = std::move( _incoming_block );
+            _incoming_block.reset();
+
+            app().get_io_service().post( [self=shared_from_this(), trxs=std::move(trxs), block=std::move(block)]{
+               for( const auto& p : trxs ) {
+                  try {
+                     self->_incoming_transaction_async( p, false, []( const auto& ){} );
+                  } FC_LOG_AND_DROP();
+               }
+               if( block ) {
+                  try {
+                     self->_incoming_block_sync( block );
+                  } FC_LOG_AND_DROP();
+               }
+               self->_ios.post( boost::asio::bind_executor( self->_strand, [self]{ self->do_read(); } ) );
+            });
         }
 
         void on_message( const bnet_message& msg, fc::datastream<const char*>& ds ) {
@@ -998,7 +1037,7 @@ namespace eosio {
            auto id = b->id();
            mark_block_status( id, true, true );
 
-           app().get_channel<incoming::channels::block>().publish(b);
+           _incoming_block = b;
 
            mark_block_transactions_known_by_peer( b );
         }
@@ -1048,7 +1087,7 @@ namespace eosio {
            if( mark_transaction_known_by_peer( id ) )
               return;
 
-           app().get_channel<incoming::channels::transaction>().publish(p);
+           _incoming_trxs.push_back( p );
         }
 
         void on_write( boost::system::error_code ec, std::size_t bytes_transferred ) {
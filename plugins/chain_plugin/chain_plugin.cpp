@@ -213,6 +213,9 @@ void chain_plugin::set_program_options(options_description& cli, options_descrip
           "the location of the blocks directory (absolute path or relative to application data dir)")
          ("checkpoint", bpo::value<vector<string>>()->composing(), "Pairs of [BLOCK_NUM,BLOCK_ID] that should be enforced as checkpoints.")
          ("wasm-runtime", bpo::value<eosio::chain::wasm_interface::vm_type>()->value_name("wavm/binaryen"), "Override default WASM runtime")
+         ("wasm-runtime-profiling", bpo::bool_switch()->default_value(false),
+          "Write a perf map (/tmp/perf-<pid>.map) naming JIT compiled contract functions as <account>:<function> and keep their frame pointers, "
+          "so `perf record -g` samples can be folded into per-contract flame graphs (wavm only, not recommended for production nodes)")
          ("abi-serializer-max-time-ms", bpo::value<uint32_t>()->default_value(config::default_abi_serializer_max_time_ms),
           "Override default maximum ABI serialization time allowed in ms")
          ("chain-state-db-size-mb", bpo::value<uint64_t>()->default_value(config::default_state_size / (1024  * 1024)), "Maximum size (in MiB) of the chain state database")
@@ -405,6 +408,13 @@ void chain_plugin::plugin_initialize(const variables_map& options) {
       my->chain_config->force_all_checks = options.at( "force-all-checks" ).as<bool>();
       my->chain_config->disable_replay_opts = options.at( "disable-replay-opts" ).as<bool>();
       my->chain_config->contracts_console = options.at( "contracts-console" ).as<bool>();
+      my->chain_config->wasm_profiling = options.at( "wasm-runtime-profiling" ).as<bool>();
+      if( my->chain_config->wasm_profiling ) {
+         if( my->chain_config->wasm_runtime == vm_type::wavm )
+            wlog( "wasm-runtime-profiling enabled, contract functions are written to /tmp/perf-<pid>.map" );
+         else
+            wlog( "wasm-runtime-profiling is only supported by the wavm runtime and will be ignored" );
+      }
 
       if( options.count( "extract-genesis-json" ) || options.at( "print-genesis-json" ).as<bool>()) {
          genesis_state gs;
@@ -10,11 +10,30 @@
 namespace eosio {
    using namespace appbase;
 
+   struct message_count {
+      string            type;
+      uint64_t          count = 0;
+   };
+
+   /// traffic and timing of a connection since it was last opened
+   struct connection_metrics {
+      uint64_t              bytes_received = 0;
+      uint64_t              bytes_sent = 0;
+      uint64_t              messages_sent = 0;
+      vector<message_count> messages_received; ///< by message type
+      uint32_t              blocks_received = 0; ///< new blocks received while in sync
+      int64_t               block_lag_us = 0; ///< moving average of block arrival time minus block timestamp
+      uint32_t              write_queue_depth = 0; ///< messages waiting to be written
+      uint64_t              write_queue_bytes = 0;
+      int64_t               rtt_us = -1; ///< moving average of the round trip time measured by time_message, -1 until known
+   };
+
    struct connection_status {
-      string            peer;
-      bool              connecting = false;
-      bool              syncing    = false;
-      handshake_message last_handshake;
+      string             peer;
+      bool               connecting = false;
+      bool               syncing    = false;
+      handshake_message  last_handshake;
+      connection_metrics metrics;
    };
 
    class net_plugin : public appbase::plugin<net_plugin>
@@ -44,4 +63,7 @@ namespace eosio {
 
 }
 
-FC_REFLECT( eosio::connection_status, (peer)(connecting)(syncing)(last_handshake) )
+FC_REFLECT( eosio::message_count, (type)(count) )
+FC_REFLECT( eosio::connection_metrics, (bytes_received)(bytes_sent)(messages_sent)(messages_received)(blocks_received)
+            (block_lag_us)(write_queue_depth)(write_queue_bytes)(rtt_us) )
+FC_REFLECT( eosio::connection_status, (peer)(connecting)(syncing)(last_handshake)(metrics) )
@@ -137,6 +137,34 @@ namespace eosio {
       uint32_t end_block;
    };
 
+   /**
+    *  A block whose packed transactions were replaced by their ids, relayed to peers that most likely
+    *  received those transactions already. The receiver rebuilds the block from the transactions it
+    *  has seen and asks for the ones it is missing with a block_transactions_request_message.
+    */
+   struct compact_block_message {
+      signed_block               block;
+      vector<uint32_t>           compacted; ///< indices into block.transactions of the receipts reduced to an id
+   };
+
+   struct block_transactions_request_message {
+      block_id_type              block_id;
+      vector<uint32_t>           indices; ///< into the transactions of the block
+   };
+
+   struct block_transactions_message {
+      block_id_type              block_id;
+      vector<packed_transaction> trxs; ///< in the order requested, empty if the block is not available
+   };
+
+   /**
+    *  A signed_block sent in response to a sync_request_message, compressed with zlib. Only sent to
+    *  peers whose network version supports it; the receiver handles it exactly like the signed_block.
+    */
+   struct compressed_block_message {
+      bytes                      data; ///< zlib compressed packed signed_block
+   };
+
    using net_message = static_variant<handshake_message,
                                       chain_size_message,
                                       go_away_message,
@@ -145,7 +173,11 @@ namespace eosio {
                                       request_message,
                                       sync_request_message,
                                       signed_block,
-                                      packed_transaction>;
+                                      packed_transaction,
+                                      compact_block_message,
+                                      block_transactions_request_message,
+                                      block_transactions_message,
+                                      compressed_block_message>;
 
 } // namespace eosio
 
@@ -164,6 +196,10 @@ FC_REFLECT( eosio::time_message, (org)(rec)(xmt)(dst) )
 FC_REFLECT( eosio::notice_message, (known_trx)(known_blocks) )
 FC_REFLECT( eosio::request_message, (req_trx)(req_blocks) )
 FC_REFLECT( eosio::sync_request_message, (start_block)(end_block) )
+FC_REFLECT( eosio::compact_block_message, (block)(compacted) )
+FC_REFLECT( eosio::block_transactions_request_message, (block_id)(indices) )
+FC_REFLECT( eosio::block_transactions_message, (block_id)(trxs) )
+FC_REFLECT( eosio::compressed_block_message, (data) )
 
 /**
  *
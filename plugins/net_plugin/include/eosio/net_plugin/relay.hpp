@@ -0,0 +1,682 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+#include <eosio/net_plugin/protocol.hpp>
+
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace eosio { namespace chain { class controller; } }
+
+/**
+ *  The parts of the net_plugin relay that do not touch sockets, timers or the application.
+ *
+ *  net_plugin_impl holds one node's worth of these; nothing here is global except the buffer pool, so
+ *  several nodes can use them side by side in one process.
+ */
+namespace eosio {
+
+   /**
+    *  Recycles the buffers outgoing messages are serialized into. Buffers are handed out in power of two
+    *  size classes; a released buffer is kept for the next message of its class while the class holds
+    *  less than max_pooled_bytes, and messages larger than the largest class are left to the allocator.
+    */
+   class send_buffer_pool {
+   public:
+      static constexpr size_t min_class_size = 256;
+      static constexpr size_t max_class_size = 1024*1024;
+      static constexpr size_t max_pooled_bytes = 4*1024*1024; ///< per size class
+
+      /// shared by all connections; never destroyed, so it outlives every buffer it handed out
+      static send_buffer_pool& instance() {
+         static send_buffer_pool* pool = new send_buffer_pool();
+         return *pool;
+      }
+
+      std::shared_ptr<vector<char>> get( size_t size ) {
+         if( size > max_class_size ) {
+            return std::make_shared<vector<char>>( size );
+         }
+         size_t cls = size_class( size );
+         vector<char>* buffer = nullptr;
+         {
+            std::lock_guard<std::mutex> g( mtx );
+            auto& free_list = free_buffers[cls];
+            if( !free_list.empty() ) {
+               buffer = free_list.back();
+               free_list.pop_back();
+            }
+         }
+         if( !buffer ) {
+            buffer = new vector<char>();
+            buffer->reserve( min_class_size << cls );
+         }
+         buffer->resize( size );
+         return std::shared_ptr<vector<char>>( buffer, [this]( vector<char>* b ) { release( b ); } );
+      }
+
+   private:
+      send_buffer_pool() : free_buffers( size_class( max_class_size ) + 1 ) {}
+
+      static size_t size_class( size_t size ) {
+         size_t cls = 0;
+         while( (min_class_size << cls) < size )
+            ++cls;
+         return cls;
+      }
+
+      void release( vector<char>* buffer ) {
+         size_t cls = size_class( buffer->capacity() );
+         if( cls < free_buffers.size() ) {
+            std::lock_guard<std::mutex> g( mtx );
+            auto& free_list = free_buffers[cls];
+            if( (free_list.size() + 1) * (min_class_size << cls) <= max_pooled_bytes ) {
+               buffer->clear();
+               free_list.push_back( buffer );
+               return;
+            }
+         }
+         delete buffer;
+      }
+
+      std::mutex                     mtx; ///< buffers may be released on any thread
+      vector<vector<vector<char>*>>  free_buffers; ///< by size class
+   };
+
+   /// header and payload of msg, ready to be queued on any number of connections
+   std::shared_ptr<vector<char>> create_send_buffer( const net_message& msg );
+
+   constexpr size_t   max_inflated_message_size = 8*1024*1024; ///< twice the default send buffer
+
+   /// b as a compressed_block_message, or as a plain signed_block if it packs to less than min_size
+   std::shared_ptr<vector<char>> create_sync_block_buffer( const signed_block& b, uint32_t min_size );
+   /// replaces a compressed_block_message by the signed_block it carries
+   void inflate_message( net_message& msg );
+
+   bytes zlib_compress( const bytes& data );
+   /// throws plugin_exception if data is not valid or inflates beyond max_inflated_message_size
+   bytes zlib_decompress( const bytes& data );
+
+   bool matches_transaction_mroot( const signed_block& b );
+   /**
+    *  True if b may be relayed before it is applied: its header links to a block cc knows, it is signed by the
+    *  scheduled producer and its transactions match the header. Throws if the header does not validate.
+    */
+   bool relayable_header( const chain::controller& cc, const signed_block& b );
+
+   /**
+    *  Logical send queues of a connection. Control messages always go first; the other queues share
+    *  each gathered write by deficit round robin, every round granting a queue its weight times
+    *  write_quantum bytes. A write stops taking messages once it holds max_write_batch bytes, so a
+    *  message queued behind a busy socket waits for at most one such write.
+    */
+   enum send_priority : uint8_t {
+      control_priority = 0,  ///< handshakes, time, go away, notices and requests
+      block_priority,        ///< blocks relayed at head, and fork branches so they stay ahead of them
+      transaction_priority,  ///< relayed transactions
+      sync_priority,         ///< blocks sent to a peer catching up
+      num_priorities
+   };
+   constexpr uint32_t send_weights[num_priorities] = { 0, 8, 4, 1 };
+   constexpr size_t   write_quantum = 16*1024;
+   constexpr size_t   max_write_batch = 256*1024;
+
+   /// the send queue msg goes to unless its sender knows better
+   send_priority priority_of( const net_message& msg );
+
+   /// queued writes of one peer; T holds the serialized message in a shared_ptr<vector<char>> named buff
+   template<typename T>
+   class send_queues {
+   public:
+      void push( send_priority priority, T&& w ) {
+         queues[priority].push_back( std::move(w) );
+      }
+
+      size_t size()const {
+         size_t s = 0;
+         for( const auto& q : queues ) {
+            s += q.size();
+         }
+         return s;
+      }
+
+      bool empty()const { return size() == 0; }
+
+      template<typename F>
+      void for_each( F&& f )const {
+         for( const auto& q : queues ) {
+            for( const auto& w : q ) {
+               f( w );
+            }
+         }
+      }
+
+      void clear() {
+         for( auto& q : queues ) {
+            q.clear();
+         }
+         deficits.fill( 0 );
+      }
+
+      /// moves the messages of the next write to out, returns their size in bytes
+      size_t next_batch( std::deque<T>& out ) {
+         size_t batch_size = 0;
+         auto take = [&]( std::deque<T>& q ) {
+            batch_size += q.front().buff->size();
+            out.push_back( std::move( q.front() ) );
+            q.pop_front();
+         };
+         auto& control = queues[control_priority];
+         while( !control.empty() ) {
+            take( control );
+         }
+         bool pending = true;
+         while( pending && batch_size < max_write_batch ) {
+            pending = false;
+            for( size_t p = block_priority; p < num_priorities; ++p ) {
+               auto& q = queues[p];
+               if( q.empty() ) {
+                  continue;
+               }
+               deficits[p] += send_weights[p] * write_quantum;
+               while( !q.empty() && q.front().buff->size() <= deficits[p] ) {
+                  deficits[p] -= q.front().buff->size();
+                  take( q );
+               }
+               if( q.empty() ) {
+                  // an idle queue does not bank credit
+                  deficits[p] = 0;
+               } else {
+                  pending = true;
+               }
+            }
+         }
+         return batch_size;
+      }
+
+   private:
+      std::array<std::deque<T>, num_priorities> queues;
+      std::array<size_t, num_priorities>        deficits{}; ///< bytes each queue may still send this round
+   };
+
+   constexpr uint64_t peer_txn_filter_bits = 1 << 20; ///< per generation, a power of two
+   constexpr uint32_t peer_txn_filter_capacity = 50000; ///< ids per generation, about 0.1% false positives
+
+   /**
+    *  Ids of the transactions a peer is known to have, kept as two generations of bloom filter.
+    *
+    *  New ids go into the current filter; once it holds peer_txn_filter_capacity ids it becomes the
+    *  previous one and a cleared filter takes its place, so the size is fixed and ids age out after two
+    *  generations. Transaction ids are uniformly distributed already, so each 64 bit word of the id
+    *  picks one bit.
+    *
+    *  A false positive means a transaction is neither pushed nor announced to that peer, there is no
+    *  fallback: the peer gets it from another of its peers or in a block. Announcing on every hit instead
+    *  would spend an id on each transaction the peer does have, which is the traffic the filter saves.
+    */
+   class peer_txn_filter {
+   public:
+      peer_txn_filter()
+         : current(peer_txn_filter_bits / 64), previous(peer_txn_filter_bits / 64) {}
+
+      bool contains( const transaction_id_type& id )const {
+         return test( current, id ) || test( previous, id );
+      }
+
+      void insert( const transaction_id_type& id ) {
+         if( contains( id ) ) {
+            return;
+         }
+         if( current_count >= peer_txn_filter_capacity ) {
+            std::swap( current, previous );
+            std::fill( current.begin(), current.end(), 0 );
+            current_count = 0;
+         }
+         for( auto word : id._hash ) {
+            auto bit = word & (peer_txn_filter_bits - 1);
+            current[bit / 64] |= uint64_t(1) << (bit % 64);
+         }
+         ++current_count;
+      }
+
+      void clear() {
+         std::fill( current.begin(), current.end(), 0 );
+         std::fill( previous.begin(), previous.end(), 0 );
+         current_count = 0;
+      }
+
+   private:
+      static bool test( const vector<uint64_t>& filter, const transaction_id_type& id ) {
+         for( auto word : id._hash ) {
+            auto bit = word & (peer_txn_filter_bits - 1);
+            if( !(filter[bit / 64] & (uint64_t(1) << (bit % 64))) ) {
+               return false;
+            }
+         }
+         return true;
+      }
+
+      vector<uint64_t> current;
+      vector<uint64_t> previous;
+      uint32_t         current_count = 0;
+   };
+
+   struct node_transaction_state {
+      transaction_id_type id;
+      time_point_sec  expires;  /// time after which this may be purged.
+      packed_transaction packed_txn;
+      std::shared_ptr<vector<char>> serialized_txn; /// the received raw bundle, shared by every queued write of it
+      uint32_t        block_num = 0; /// block transaction was included in
+   };
+
+   /**
+    *  Transactions relayed by this node, de-duplicated by id.
+    *
+    *  Entries live in one hash table and are also filed in buckets, one per second of expiry and one per
+    *  block they were included in. Purging drops whole buckets from the front, so it only costs the
+    *  entries actually removed. Buckets are not updated when an entry changes block, an id is erased only
+    *  if its entry still belongs to the bucket being dropped.
+    *
+    *  Queued writes hold the serialized transaction by shared pointer, so an entry may be erased while it
+    *  is still being sent to a peer.
+    */
+   class node_transaction_index {
+   public:
+      typedef std::unordered_map<transaction_id_type, node_transaction_state, std::hash<transaction_id_type>> map_type;
+      typedef map_type::const_iterator const_iterator;
+
+      size_t         size()const  { return txns.size(); }
+      const_iterator begin()const { return txns.begin(); }
+      const_iterator end()const   { return txns.end(); }
+
+      const node_transaction_state* find( const transaction_id_type& id )const {
+         auto itr = txns.find( id );
+         return itr != txns.end() ? &itr->second : nullptr;
+      }
+
+      bool insert( node_transaction_state&& nts ) {
+         auto id = nts.id;
+         auto exp = nts.expires.sec_since_epoch();
+         if( !txns.emplace( id, std::move(nts) ).second ) {
+            return false;
+         }
+         by_expiry[exp].push_back( id );
+         return true;
+      }
+
+      void set_block_num( const transaction_id_type& id, uint32_t block_num ) {
+         auto itr = txns.find( id );
+         if( itr == txns.end() || itr->second.block_num == block_num ) {
+            return;
+         }
+         itr->second.block_num = block_num;
+         by_block_num[block_num].push_back( id );
+      }
+
+      /// Drops every transaction that expires at or before now
+      void erase_expired( time_point_sec now ) {
+         erase_through( by_expiry, now.sec_since_epoch(), []( const node_transaction_state& nts ) {
+            return nts.expires.sec_since_epoch();
+         } );
+      }
+
+      /// Drops every transaction included in a block at or below block_num
+      void erase_included( uint32_t block_num ) {
+         erase_through( by_block_num, block_num, []( const node_transaction_state& nts ) {
+            return nts.block_num;
+         } );
+      }
+
+   private:
+      typedef std::map<uint32_t, vector<transaction_id_type>> bucket_map;
+
+      template<typename KeyOf>
+      void erase_through( bucket_map& buckets, uint32_t last, KeyOf key_of ) {
+         auto bucket = buckets.begin();
+         for( ; bucket != buckets.end() && bucket->first <= last; ++bucket ) {
+            for( const auto& id : bucket->second ) {
+               auto itr = txns.find( id );
+               if( itr != txns.end() && key_of( itr->second ) == bucket->first ) {
+                  txns.erase( itr );
+               }
+            }
+         }
+         buckets.erase( buckets.begin(), bucket );
+      }
+
+      map_type   txns;
+      bucket_map by_expiry;
+      bucket_map by_block_num;
+   };
+
+   /**
+    *  Announced transactions requested from a peer, so a second peer announcing one is not asked for it too
+    *  while the first request is outstanding. At most max_requests are, further announcements are ignored.
+    */
+   class transaction_requests {
+   public:
+      static constexpr size_t max_requests = 100000;
+
+      size_t size()const { return requests.size(); }
+
+      void erase( const transaction_id_type& id ) { requests.erase( id ); }
+
+      /// Forgets the requests that expire at or before now, their ids may be requested again
+      void erase_expired( time_point_sec now ) {
+         for( auto itr = requests.begin(); itr != requests.end(); ) {
+            if( itr->second <= now ) {
+               itr = requests.erase( itr );
+            } else {
+               ++itr;
+            }
+         }
+      }
+
+      /**
+       *  Appends to ids the announced ids to request from the peer that announced them, the ones neither in
+       *  local_txns nor requested already, and records them until expires. Each id considered is added to
+       *  known, the ids the peer has. Returns false if it stopped at max_requests.
+       */
+      bool select( const vector<transaction_id_type>& announced, const node_transaction_index& local_txns,
+                   peer_txn_filter& known, time_point_sec expires, vector<transaction_id_type>& ids ) {
+         for( const auto& id : announced ) {
+            known.insert( id );
+            if( local_txns.find( id ) ) {
+               continue;
+            }
+            if( requests.size() >= max_requests ) {
+               return false;
+            }
+            if( requests.emplace( id, expires ).second ) {
+               ids.push_back( id );
+            }
+         }
+         return true;
+      }
+
+   private:
+      std::map<transaction_id_type, time_point_sec> requests;
+   };
+
+   /// b with the packed transactions found in local_txns reduced to their ids
+   compact_block_message make_compact_block( const signed_block& b, const node_transaction_index& local_txns );
+   /**
+    *  Puts the transactions of local_txns back into the compacted receipts of b, and collects the indices of
+    *  the ones it does not have in missing. Returns false if compacted holds an index that is not an id receipt.
+    */
+   bool fill_compact_block( signed_block& b, const vector<uint32_t>& compacted, const node_transaction_index& local_txns,
+                            vector<uint32_t>& missing );
+   /// puts the transactions of msg into the missing receipts of pending, returns false if msg does not have them all
+   bool complete_compact_block( compact_block_message& pending, const block_transactions_message& msg );
+
+   /// compact blocks received from one peer that wait for the transactions requested from it, by block id
+   class compact_block_requests {
+   public:
+      static constexpr size_t max_blocks = 8;
+
+      /// keeps cb, with compacted holding the requested indices; returns the lowest block if it had to make room for cb
+      optional<block_id_type> add( compact_block_message&& cb ) {
+         optional<block_id_type> dropped;
+         auto id = cb.block.id();
+         if( blocks.size() >= max_blocks && !blocks.count( id ) ) {
+            auto oldest = std::min_element( blocks.begin(), blocks.end(), []( const auto& l, const auto& r ) {
+               return l.second.block.block_num() < r.second.block.block_num();
+            } );
+            dropped = oldest->first;
+            blocks.erase( oldest );
+         }
+         blocks[id] = std::move( cb );
+         return dropped;
+      }
+
+      optional<compact_block_message> take( const block_id_type& id ) {
+         optional<compact_block_message> result;
+         auto itr = blocks.find( id );
+         if( itr != blocks.end() ) {
+            result = std::move( itr->second );
+            blocks.erase( itr );
+         }
+         return result;
+      }
+
+      size_t size()const { return blocks.size(); }
+      void clear() { blocks.clear(); }
+
+   private:
+      std::map<block_id_type, compact_block_message> blocks;
+   };
+
+   /// true if a peer with round trip rtt_us is expected to answer sooner than one with other_rtt_us; -1 is not measured yet, and comes last
+   inline bool answers_sooner( int64_t rtt_us, int64_t other_rtt_us ) {
+      return rtt_us >= 0 && ( other_rtt_us < 0 || rtt_us < other_rtt_us );
+   }
+
+   /// rtt_us with a new measurement folded in, weighing the new one a quarter; -1 is not measured yet
+   inline int64_t smoothed_round_trip( int64_t rtt_us, int64_t sample_us ) {
+      if( sample_us < 0 ) {
+         return rtt_us;
+      }
+      return rtt_us < 0 ? sample_us : ( rtt_us * 3 + sample_us ) / 4;
+   }
+
+   /// orders peers shortest round trip first, keeping the order of equals; rtt_of(p) is the round trip of p, or -1
+   template<typename Peer, typename RttOf>
+   void sort_by_latency( vector<Peer>& peers, RttOf&& rtt_of ) {
+      std::stable_sort( peers.begin(), peers.end(), [&]( const Peer& a, const Peer& b ) {
+         return answers_sooner( rtt_of( a ), rtt_of( b ) );
+      });
+   }
+
+   /**
+    *  The eligible peer of [begin, end) with the shortest round trip. Peers are considered from first to end and
+    *  then from begin, so among equals the one after the last peer picked comes next. Returns end if none is.
+    */
+   template<typename Itr, typename Eligible, typename RttOf>
+   Itr fastest_peer( Itr begin, Itr first, Itr end, Eligible&& eligible, RttOf&& rtt_of ) {
+      Itr best = end;
+      auto consider = [&]( Itr i ) {
+         if( eligible( *i ) && ( best == end || answers_sooner( rtt_of( *i ), rtt_of( *best ) ) ) ) {
+            best = i;
+         }
+      };
+      for( auto i = first; i != end; ++i ) {
+         consider( i );
+      }
+      for( auto i = begin; i != first; ++i ) {
+         consider( i );
+      }
+      return best;
+   }
+
+   /**
+    *  Block ranges requested from several peers at once while catching up, and the blocks that arrived
+    *  ahead of the next block to apply. Peer identifies a peer; a default constructed Peer is no peer.
+    */
+   template<typename Peer>
+   class sync_ranges {
+   public:
+      struct range {
+         Peer     source; ///< empty while waiting to be handed to another peer
+         uint32_t end = 0;
+         uint32_t next = 0; ///< next block expected from source
+      };
+      typedef std::map<uint32_t, range> range_map; ///< by first block
+
+      enum class progress {
+         none,     ///< not a block of a range of this peer, or one it sent already
+         ongoing,
+         finished  ///< the last block of the range, which is removed
+      };
+
+      enum class arrival {
+         apply,    ///< not ahead of the ranges, apply it now
+         buffered, ///< kept until the blocks before it are applied
+         ignored   ///< not from the peer its range is assigned to
+      };
+
+      range_map&       ranges()       { return _ranges; }
+      const range_map& ranges()const  { return _ranges; }
+      bool             empty()const   { return _ranges.empty(); }
+
+      bool is_source( const Peer& p )const {
+         for( const auto& r : _ranges ) {
+            if( r.second.source == p ) {
+               return true;
+            }
+         }
+         return false;
+      }
+
+      /// ranges that have a source
+      size_t busy()const {
+         size_t n = 0;
+         for( const auto& r : _ranges ) {
+            if( r.second.source ) {
+               ++n;
+            }
+         }
+         return n;
+      }
+
+      range& add( uint32_t start, uint32_t end ) {
+         auto& r = _ranges[start];
+         r.end = end;
+         return r;
+      }
+
+      static void assign( range& r, uint32_t start, const Peer& p ) {
+         r.source = p;
+         r.next = start;
+      }
+
+      /**
+       *  Hands ranges to the peers next_source() returns until max_sources ranges have a source or it returns
+       *  no peer: first the ranges that lost theirs, then new ranges of up to span blocks after last_requested,
+       *  which is advanced, up to known. request(r, p) is called once r is assigned to p. Returns busy().
+       */
+      template<typename NextSource, typename Request>
+      size_t schedule( uint32_t next_expected, uint32_t& last_requested, uint32_t known, uint32_t span,
+                       size_t max_sources, NextSource&& next_source, Request&& request ) {
+         for( auto& r : _ranges ) {
+            if( r.second.source ) {
+               continue;
+            }
+            Peer p = next_source();
+            if( !p ) {
+               return busy();
+            }
+            assign( r.second, r.second.next, p );
+            request( r.second, p );
+         }
+         size_t n = busy();
+         while( n < max_sources && last_requested < known ) {
+            Peer p = next_source();
+            if( !p ) {
+               break;
+            }
+            uint32_t start = std::max( last_requested + 1, next_expected );
+            uint32_t end = std::min( start + span - 1, known );
+            if( end < start ) {
+               break;
+            }
+            auto& r = add( start, end );
+            assign( r, start, p );
+            request( r, p );
+            last_requested = end;
+            ++n;
+         }
+         return n;
+      }
+
+      /// the ranges of p wait for another peer
+      void release( const Peer& p ) {
+         for( auto& r : _ranges ) {
+            if( r.second.source == p ) {
+               r.second.source = Peer();
+            }
+         }
+      }
+
+      void clear() {
+         _ranges.clear();
+         _early.clear();
+      }
+
+      /// records that p delivered blk_num
+      progress advance( const Peer& p, uint32_t blk_num ) {
+         auto itr = _ranges.begin();
+         for( ; itr != _ranges.end(); ++itr ) {
+            if( itr->second.source == p && blk_num >= itr->first && blk_num <= itr->second.end ) {
+               break;
+            }
+         }
+         if( itr == _ranges.end() || blk_num < itr->second.next ) {
+            return progress::none;
+         }
+         itr->second.next = blk_num + 1;
+         if( blk_num < itr->second.end ) {
+            return progress::ongoing;
+         }
+         _ranges.erase( itr );
+         return progress::finished;
+      }
+
+      /**
+       *  The first range, if p just finished a range while that one, which everything else waits on, is still
+       *  far from done: p is the faster peer and should take over the rest of it.
+       */
+      range* takeover( const Peer& p, uint32_t span ) {
+         if( _ranges.empty() ) {
+            return nullptr;
+         }
+         auto& head = _ranges.begin()->second;
+         if( head.source && head.source != p && head.end - head.next + 1 > span / 2 && !is_source( p ) ) {
+            return &head;
+         }
+         return nullptr;
+      }
+
+      /**
+       *  Keeps b if it belongs to a range after next_expected and comes from the source of that range. Anything
+       *  else from that range is left over from a range that moved to another peer, or was never asked for.
+       */
+      arrival buffer( const Peer& p, const signed_block& b, uint32_t next_expected, uint32_t last_requested ) {
+         uint32_t blk_num = b.block_num();
+         if( blk_num <= next_expected || blk_num > last_requested || _ranges.empty() || blk_num < _ranges.begin()->first ) {
+            return arrival::apply;
+         }
+         auto r = std::prev( _ranges.upper_bound( blk_num ) );
+         if( blk_num > r->second.end || r->second.source != p ) {
+            return arrival::ignored;
+         }
+         _early[blk_num] = std::make_pair( p, std::make_shared<signed_block>( b ) );
+         return arrival::buffered;
+      }
+
+      /// takes block next_expected out of the buffered blocks, if it arrived
+      bool next_early( uint32_t next_expected, Peer& p, signed_block_ptr& b ) {
+         while( !_early.empty() && _early.begin()->first < next_expected ) {
+            _early.erase( _early.begin() );
+         }
+         if( _early.empty() || _early.begin()->first != next_expected ) {
+            return false;
+         }
+         p = _early.begin()->second.first;
+         b = _early.begin()->second.second;
+         _early.erase( _early.begin() );
+         return true;
+      }
+
+   private:
+      range_map                                                _ranges;
+      std::map<uint32_t, std::pair<Peer, signed_block_ptr>>    _early; ///< arrived ahead of the next block to apply
+   };
+
+} // namespace eosio
@@ -6,6 +6,7 @@
 
 #include <eosio/net_plugin/net_plugin.hpp>
 #include <eosio/net_plugin/protocol.hpp>
+#include <eosio/net_plugin/relay.hpp>
 #include <eosio/chain/controller.hpp>
 #include <eosio/chain/exceptions.hpp>
 #include <eosio/chain/block.hpp>
@@ -29,6 +30,13 @@
 #include <boost/asio/steady_timer.hpp>
 #include <boost/intrusive/set.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <map>
+#include <thread>
+#include <unordered_map>
+
 using namespace eosio::chain::plugin_interface::compat;
 
 namespace fc {
@@ -72,61 +80,6 @@ namespace eosio {
       return r;
    }
 
-   struct node_transaction_state {
-      transaction_id_type id;
-      time_point_sec  expires;  /// time after which this may be purged.
-                                /// Expires increased while the txn is
-                                /// "in flight" to anoher peer
-      packed_transaction packed_txn;
-      vector<char>    serialized_txn; /// the received raw bundle
-      uint32_t        block_num = 0; /// block transaction was included in
-      uint32_t        true_block = 0; /// used to reset block_uum when request is 0
-      uint16_t        requests = 0; /// the number of "in flight" requests for this txn
-   };
-
-   struct update_in_flight {
-      int32_t incr;
-      update_in_flight (int32_t delta) : incr (delta) {}
-      void operator() (node_transaction_state& nts) {
-         int32_t exp = nts.expires.sec_since_epoch();
-         nts.expires = fc::time_point_sec (exp + incr * 60);
-         if( nts.requests == 0 ) {
-            nts.true_block = nts.block_num;
-            nts.block_num = 0;
-         }
-         nts.requests += incr;
-         if( nts.requests == 0 ) {
-            nts.block_num = nts.true_block;
-         }
-      }
-   } incr_in_flight(1), decr_in_flight(-1);
-
-   struct by_expiry;
-   struct by_block_num;
-
-   typedef multi_index_container<
-      node_transaction_state,
-      indexed_by<
-         ordered_unique<
-            tag< by_id >,
-            member < node_transaction_state,
-                     transaction_id_type,
-                     &node_transaction_state::id > >,
-         ordered_non_unique<
-            tag< by_expiry >,
-            member< node_transaction_state,
-                    fc::time_point_sec,
-                    &node_transaction_state::expires >
-            >,
-         ordered_non_unique<
-            tag<by_block_num>,
-            member< node_transaction_state,
-                    uint32_t,
-                    &node_transaction_state::block_num > >
-         >
-      >
-   node_transaction_index;
-
    class net_plugin_impl {
    public:
       unique_ptr<tcp::acceptor>        acceptor;
@@ -151,6 +104,13 @@ namespace eosio {
 
       connection_ptr find_connection( string host )const;
 
+      /// connection sockets live on thread_pool_ios; everything else runs on the application thread.
+      /// Declared ahead of connections so the sockets are destroyed before the io_service they use.
+      uint16_t                                      thread_pool_size = 2;
+      unique_ptr<boost::asio::io_service>           thread_pool_ios;
+      optional<boost::asio::io_service::work>       thread_pool_work;
+      vector<std::thread>                           thread_pool;
+
       std::set< connection_ptr >       connections;
       bool                             done = false;
       unique_ptr< sync_manager >       sync_master;
@@ -159,6 +119,8 @@ namespace eosio {
       unique_ptr<boost::asio::steady_timer> connector_check;
       unique_ptr<boost::asio::steady_timer> transaction_check;
       unique_ptr<boost::asio::steady_timer> keepalive_timer;
+      unique_ptr<boost::asio::steady_timer> announce_timer;
+      bool                                  announce_pending = false;
       boost::asio::steady_timer::duration   connector_period;
       boost::asio::steady_timer::duration   txn_exp_period;
       boost::asio::steady_timer::duration   resp_expected_period;
@@ -180,6 +142,10 @@ namespace eosio {
       shared_ptr<tcp::resolver>     resolver;
 
       bool                          use_socket_read_watermark = false;
+      bool                          compact_block_relay = true;
+      bool                          header_validated_relay = false;
+      bool                          sync_compression = false;
+      uint32_t                      sync_compression_min_size = 0;
 
       channels::transaction_ack::channel_type::handle  incoming_transaction_ack_subscription;
 
@@ -190,10 +156,17 @@ namespace eosio {
       void start_read_message( connection_ptr c);
 
       void   close( connection_ptr c );
+      /// close from a network thread: logs and closes c on the application thread
+      void   close_on_app_thread( const connection_ptr& c, const string& reason );
       size_t count_open_sockets() const;
+      /// peers with the shortest round trip first, so they are the first to be written to
+      vector<connection_ptr> connections_by_latency() const;
 
       template<typename VerifierFunc>
       void send_all( const net_message &msg, VerifierFunc verify );
+      /// queues one already serialized message on every current connection accepted by verify
+      template<typename VerifierFunc>
+      void send_all( const std::shared_ptr<vector<char>>& send_buffer, send_priority priority, VerifierFunc verify );
 
       void accepted_block_header(const block_state_ptr&);
       void accepted_block(const block_state_ptr&);
@@ -228,11 +201,22 @@ namespace eosio {
       void handle_message( connection_ptr c, const request_message &msg);
       void handle_message( connection_ptr c, const sync_request_message &msg);
       void handle_message( connection_ptr c, const signed_block &msg);
+      void process_block( connection_ptr c, const signed_block_ptr& sbp);
       void handle_message( connection_ptr c, const packed_transaction &msg);
+      void handle_message( connection_ptr c, const compact_block_message &msg);
+      void handle_message( connection_ptr c, const block_transactions_request_message &msg);
+      void handle_message( connection_ptr c, const block_transactions_message &msg);
+      void handle_message( connection_ptr c, const compressed_block_message &msg);
+
+      /// accepts a block rebuilt from a compact_block_message, or asks c for the full block if it does not match its header
+      void accept_compact_block( connection_ptr c, const signed_block& b );
+      void request_full_block( connection_ptr c, const block_id_type& id );
 
       void start_conn_timer(boost::asio::steady_timer::duration du, std::weak_ptr<connection> from_connection);
       void start_txn_timer( );
       void start_monitors( );
+      /// sends the transaction announcements collected by all connections once the announce window is over
+      void start_announce_timer( );
 
       void expire_txns( );
       void connection_monitor(std::weak_ptr<connection> from_connection);
@@ -320,10 +304,16 @@ namespace eosio {
    constexpr auto     def_txn_expire_wait = std::chrono::seconds(3);
    constexpr auto     def_resp_expected_wait = std::chrono::seconds(5);
    constexpr auto     def_sync_fetch_span = 100;
+   constexpr uint32_t def_sync_fetch_peers = 3;
    constexpr uint32_t  def_max_just_send = 1500; // roughly 1 "mtu"
+   constexpr uint32_t  def_txn_announce_window_ms = 0; // 0 sends whole transactions right away
+   constexpr uint32_t  def_txn_announce_max_ids = 1000;
    constexpr bool     large_msg_notify = false;
 
    constexpr auto     message_header_size = 4;
+   constexpr uint32_t max_incoming_messages = 1000; ///< per connection, decoded and waiting for the application thread
+
+   constexpr uint32_t def_sync_compression_min_size = 4096;
 
    /**
     *  For a while, network version was a 16 bit value equal to the second set of 16 bits
@@ -345,46 +335,10 @@ namespace eosio {
     */
    constexpr uint16_t proto_base = 0;
    constexpr uint16_t proto_explicit_sync = 1;
+   constexpr uint16_t proto_compact_blocks = 2;  ///< compact_block_message and block transaction requests
+   constexpr uint16_t proto_sync_compression = 3; ///< compressed_block_message
 
-   constexpr uint16_t net_version = proto_explicit_sync;
-
-   /**
-    *  Index by id
-    *  Index by is_known, block_num, validated_time, this is the order we will broadcast
-    *  to peer.
-    *  Index by is_noticed, validated_time
-    *
-    */
-   struct transaction_state {
-      transaction_id_type id;
-      bool                is_known_by_peer = false; ///< true if we sent or received this trx to this peer or received notice from peer
-      bool                is_noticed_to_peer = false; ///< have we sent peer notice we know it (true if we receive from this peer)
-      uint32_t            block_num = 0; ///< the block number the transaction was included in
-      time_point_sec      expires;
-      time_point          requested_time; /// in case we fetch large trx
-   };
-
-   struct update_txn_expiry {
-      time_point_sec new_expiry;
-      update_txn_expiry(time_point_sec e) : new_expiry(e) {}
-      void operator() (transaction_state& ts) {
-         ts.expires = new_expiry;
-      }
-   };
-
-   typedef multi_index_container<
-      transaction_state,
-      indexed_by<
-         ordered_unique< tag<by_id>, member<transaction_state, transaction_id_type, &transaction_state::id > >,
-         ordered_non_unique< tag< by_expiry >, member< transaction_state,fc::time_point_sec,&transaction_state::expires >>,
-         ordered_non_unique<
-            tag<by_block_num>,
-            member< transaction_state,
-                    uint32_t,
-                    &transaction_state::block_num > >
-         >
-
-      > transaction_state_index;
+   constexpr uint16_t net_version = proto_sync_compression;
 
    /**
     *
@@ -398,14 +352,13 @@ namespace eosio {
    };
 
    struct update_request_time {
-      void operator() (struct transaction_state &ts) {
-         ts.requested_time = time_point::now();
-      }
       void operator () (struct eosio::peer_block_state &bs) {
          bs.requested_time = time_point::now();
       }
    } set_request_time;
 
+   struct by_block_num;
+
    typedef multi_index_container<
       eosio::peer_block_state,
       indexed_by<
@@ -419,26 +372,12 @@ namespace eosio {
       void operator() (eosio::peer_block_state& bs) {
          bs.is_known = true;
       }
-      void operator() (transaction_state& ts) {
-         ts.is_known_by_peer = true;
-      }
    } set_is_known;
 
 
    struct update_block_num {
       uint32_t new_bnum;
       update_block_num(uint32_t bnum) : new_bnum(bnum) {}
-      void operator() (node_transaction_state& nts) {
-         if (nts.requests ) {
-            nts.true_block = new_bnum;
-         }
-         else {
-            nts.block_num = new_bnum;
-         }
-      }
-      void operator() (transaction_state& ts) {
-         ts.block_num = new_bnum;
-      }
       void operator() (peer_block_state& pbs) {
          pbs.block_num = new_bnum;
       }
@@ -471,20 +410,33 @@ namespace eosio {
       void initialize();
 
       peer_block_state_index  blk_state;
-      transaction_state_index trx_state;
+      peer_txn_filter         known_trxs; ///< transactions this peer has, or has announced to us
       optional<sync_state>    peer_requested;  // this peer is requesting info from us
       socket_ptr              socket;
+      /// serializes all use of socket and of the read state below on the network threads
+      boost::asio::io_service::strand strand;
+      /// readable from any thread, the socket itself may only be used on strand
+      std::atomic<bool>       socket_open{false};
+      /// advanced by close(); read and write completions of an earlier session are ignored
+      std::atomic<uint32_t>   session_generation{0};
+      /// decoded and posted to the application thread but not handled yet
+      std::atomic<uint32_t>   incoming_messages{0};
+      bool                    read_paused = false; ///< on strand, reading stopped until incoming_messages goes down
+      /// of the current session, copied in start_session so the application thread never asks the socket
+      optional<tcp::endpoint> remote_endpoint;
+      optional<tcp::endpoint> local_endpoint;
 
       fc::message_buffer<1024*1024>    pending_message_buffer;
       fc::optional<std::size_t>        outstanding_read_bytes;
-      vector<char>            blk_buffer;
 
       struct queued_write {
          std::shared_ptr<vector<char>> buff;
          std::function<void(boost::system::error_code, std::size_t)> callback;
       };
-      deque<queued_write>     write_queue;
+      send_queues<queued_write> write_queues;
       deque<queued_write>     out_queue;
+      bool                    compressing_sync_block = false; ///< a sync block is being compressed on the thread pool
+      uint32_t                flush_generation = 0; ///< advanced by flush_queues, discards compressions still running
       fc::sha256              node_id;
       handshake_message       last_handshake_recv;
       handshake_message       last_handshake_sent;
@@ -499,6 +451,21 @@ namespace eosio {
       block_id_type          fork_head;
       uint32_t               fork_head_num = 0;
       optional<request_message> last_req;
+      compact_block_requests  pending_compact_blocks; ///< partially rebuilt, compacted holds the indices requested from this peer
+      vector<transaction_id_type> pending_trx_announce; ///< sent in the next transaction notice_message
+
+      /** \name Telemetry
+       *  Reset whenever the connection is
+       *  @{
+       */
+      std::atomic<uint64_t>   bytes_received{0}; ///< counted on the network threads
+      uint64_t                bytes_sent = 0;
+      uint64_t                messages_sent = 0;
+      vector<uint64_t>        messages_received; ///< by net_message index
+      uint32_t                blocks_received = 0;
+      int64_t                 block_lag_us = 0;
+      int64_t                 rtt_us = -1;
+      /** @} */
 
       connection_status get_status()const {
          connection_status stat;
@@ -506,9 +473,18 @@ namespace eosio {
          stat.connecting = connecting;
          stat.syncing = syncing;
          stat.last_handshake = last_handshake_recv;
+         stat.metrics = get_metrics();
          return stat;
       }
 
+      connection_metrics get_metrics()const;
+      void record_block_lag( fc::microseconds lag );
+      void record_round_trip( int64_t rtt_us );
+      /// true if c is expected to answer sooner than this connection; peers not measured yet come last
+      bool slower_than( const connection_ptr& c )const {
+         return answers_sooner( c->rtt_us, rtt_us );
+      }
+
       /** \name Peer Timestamps
        *  Time message handling
        *  @{
@@ -526,6 +502,7 @@ namespace eosio {
       char                           ts[ts_buffer_size];          //!< working buffer for making human readable timestamps
       /** @} */
 
+      bool socket_is_open() const { return socket_open.load(); }
       bool connected();
       bool current();
       void reset();
@@ -562,15 +539,22 @@ namespace eosio {
 
       void txn_send_pending(const vector<transaction_id_type> &ids);
       void txn_send(const vector<transaction_id_type> &txn_lis);
+      /// sends the ids in pending_trx_announce as a notice_message, the peer requests the ones it is missing
+      void send_trx_announce();
 
       void blk_send_branch();
       void blk_send(const vector<block_id_type> &txn_lis);
       void stop_send();
 
       void enqueue( const net_message &msg, bool trigger_send = true );
+      void enqueue( const net_message &msg, bool trigger_send, send_priority priority );
+      void enqueue_buffer( const std::shared_ptr<vector<char>>& send_buffer, bool trigger_send, go_away_reason close_after_send,
+                           send_priority priority );
       void cancel_sync(go_away_reason);
       void flush_queues();
       bool enqueue_sync_block();
+      /// packs and compresses sb on the thread pool, then queues it from the application thread
+      void compress_sync_block( const signed_block_ptr& sb );
       void request_sync_blocks (uint32_t start, uint32_t end);
 
       void cancel_wait();
@@ -581,8 +565,10 @@ namespace eosio {
 
       void queue_write(std::shared_ptr<vector<char>> buff,
                        bool trigger_send,
+                       send_priority priority,
                        std::function<void(boost::system::error_code, std::size_t)> callback);
       void do_queue_write();
+      size_t write_queue_size() const;
 
       /** \brief Process the next message from the pending message buffer
        *
@@ -594,20 +580,19 @@ namespace eosio {
        * encountered unpacking or processing the message.
        */
       bool process_next_message(net_plugin_impl& impl, uint32_t message_length);
+      /// restarts reading if it was stopped for too many incoming messages
+      void resume_read();
 
       bool add_peer_block(const peer_block_state &pbs);
 
       fc::optional<fc::variant_object> _logger_variant;
       const fc::variant_object& get_logger_variant()  {
          if (!_logger_variant) {
-            boost::system::error_code ec;
-            auto rep = socket->remote_endpoint(ec);
-            string ip = ec ? "<unknown>" : rep.address().to_string();
-            string port = ec ? "<unknown>" : std::to_string(rep.port());
+            string ip = remote_endpoint ? remote_endpoint->address().to_string() : "<unknown>";
+            string port = remote_endpoint ? std::to_string(remote_endpoint->port()) : "<unknown>";
 
-            auto lep = socket->local_endpoint(ec);
-            string lip = ec ? "<unknown>" : lep.address().to_string();
-            string lport = ec ? "<unknown>" : std::to_string(lep.port());
+            string lip = local_endpoint ? local_endpoint->address().to_string() : "<unknown>";
+            string lport = local_endpoint ? std::to_string(local_endpoint->port()) : "<unknown>";
 
             _logger_variant.emplace(fc::mutable_variant_object()
                ("_name", peer_name())
@@ -643,19 +628,29 @@ namespace eosio {
          in_sync
       };
 
+      typedef sync_ranges<connection_ptr> sync_chunks;
+      typedef sync_chunks::range          sync_chunk; ///< a range of blocks requested from one peer during lib catchup
+
       uint32_t       sync_known_lib_num;
       uint32_t       sync_last_requested_num;
       uint32_t       sync_next_expected_num;
       uint32_t       sync_req_span;
-      connection_ptr source;
+      uint32_t       sync_max_sources;
+      connection_ptr source; ///< last peer a range was requested from, the round robin continues after it
       stages         state;
 
+      sync_chunks    chunks; ///< outstanding ranges, and the blocks that arrived ahead of sync_next_expected_num
+
       chain_plugin* chain_plug = nullptr;
 
       constexpr auto stage_str(stages s );
 
+      connection_ptr next_idle_source(const connection_ptr& preferred);
+      void request_chunk(const sync_chunk& chunk, const connection_ptr& c);
+      void chunk_progress(const connection_ptr& c, uint32_t blk_num);
+
    public:
-      explicit sync_manager(uint32_t span);
+      sync_manager(uint32_t span, uint32_t max_sources);
       void set_state(stages s);
       bool sync_required();
       void send_handshakes();
@@ -669,20 +664,29 @@ namespace eosio {
       void recv_block(connection_ptr c, const block_id_type &blk_id, uint32_t blk_num);
       void recv_handshake(connection_ptr c, const handshake_message& msg);
       void recv_notice(connection_ptr c, const notice_message& msg);
+      /// keeps a block that arrived ahead of the blocks before it, returns false if it should be applied now
+      bool buffer_early_block(connection_ptr c, const signed_block& blk);
+      /// takes the next block to apply out of the early blocks, if it has arrived
+      bool next_early_block(connection_ptr& c, signed_block_ptr& blk);
    };
 
    class dispatch_manager {
    public:
       uint32_t just_send_it_max = 0;
+      fc::microseconds txn_announce_window; ///< announced ids are collected this long before being sent, 0 to relay whole transactions
+      uint32_t txn_announce_max_ids = def_txn_announce_max_ids;
 
-      vector<transaction_id_type> req_trx;
+      transaction_requests req_trx; ///< requested from a peer, until received or expired
 
       std::multimap<block_id_type, connection_ptr> received_blocks;
       std::multimap<transaction_id_type, connection_ptr> received_transactions;
+      std::multimap<uint32_t, block_id_type> relayed_blocks; ///< relayed before being applied, by block number
 
       void bcast_transaction (const packed_transaction& msg);
       void rejected_transaction (const transaction_id_type& msg);
       void bcast_block (const signed_block& msg);
+      /// relay msg ahead of applying it if its header links to a known block and is signed by the scheduled producer
+      void relay_validated_header (const signed_block& msg);
       void rejected_block (const block_id_type &id);
 
       void recv_block (connection_ptr conn, const block_id_type& msg, uint32_t bnum);
@@ -696,9 +700,10 @@ namespace eosio {
 
    connection::connection( string endpoint )
       : blk_state(),
-        trx_state(),
+        known_trxs(),
         peer_requested(),
-        socket( std::make_shared<tcp::socket>( std::ref( app().get_io_service() ))),
+        socket( std::make_shared<tcp::socket>( std::ref( *my_impl->thread_pool_ios ))),
+        strand( *my_impl->thread_pool_ios ),
         node_id(),
         last_handshake_recv(),
         last_handshake_sent(),
@@ -720,9 +725,10 @@ namespace eosio {
 
    connection::connection( socket_ptr s )
       : blk_state(),
-        trx_state(),
+        known_trxs(),
         peer_requested(),
         socket( s ),
+        strand( s->get_io_service() ),
         node_id(),
         last_handshake_recv(),
         last_handshake_sent(),
@@ -751,7 +757,7 @@ namespace eosio {
    }
 
    bool connection::connected() {
-      return (socket && socket->is_open() && !connecting);
+      return (socket && socket_is_open() && !connecting);
    }
 
    bool connection::current() {
@@ -761,16 +767,80 @@ namespace eosio {
    void connection::reset() {
       peer_requested.reset();
       blk_state.clear();
-      trx_state.clear();
+      known_trxs.clear();
+      pending_compact_blocks.clear();
+      pending_trx_announce.clear();
+      bytes_received = 0;
+      bytes_sent = 0;
+      messages_sent = 0;
+      messages_received.clear();
+      blocks_received = 0;
+      block_lag_us = 0;
+      rtt_us = -1;
+   }
+
+   struct msg_type_name_visitor : public fc::visitor<const char*> {
+      template <typename T>
+      const char* operator()(const T&) const { return fc::get_typename<T>::name(); }
+   };
+
+   connection_metrics connection::get_metrics()const {
+      connection_metrics m;
+      m.bytes_received = bytes_received;
+      m.bytes_sent = bytes_sent;
+      m.messages_sent = messages_sent;
+      for( size_t i = 0; i < messages_received.size(); ++i ) {
+         if( messages_received[i] == 0 )
+            continue;
+         net_message msg;
+         msg.set_which( i );
+         m.messages_received.push_back( message_count{ msg.visit( msg_type_name_visitor() ), messages_received[i] } );
+      }
+      m.blocks_received = blocks_received;
+      m.block_lag_us = block_lag_us;
+      write_queues.for_each( [&m]( const queued_write& w ) {
+         ++m.write_queue_depth;
+         m.write_queue_bytes += w.buff->size();
+      } );
+      for( const auto& w : out_queue ) {
+         ++m.write_queue_depth;
+         m.write_queue_bytes += w.buff->size();
+      }
+      m.rtt_us = rtt_us;
+      return m;
+   }
+
+   void connection::record_block_lag( fc::microseconds lag ) {
+      block_lag_us = blocks_received == 0 ? lag.count() : ( block_lag_us * 7 + lag.count() ) / 8;
+      ++blocks_received;
+   }
+
+   void connection::record_round_trip( int64_t rtt ) {
+      rtt_us = smoothed_round_trip( rtt_us, rtt );
    }
 
    void connection::flush_queues() {
-      write_queue.clear();
+      write_queues.clear();
+      compressing_sync_block = false;
+      ++flush_generation;
+   }
+
+   size_t connection::write_queue_size() const {
+      return write_queues.size();
    }
 
    void connection::close() {
+      socket_open = false;
+      ++session_generation;
       if(socket) {
-         socket->close();
+         auto self = shared_from_this();
+         strand.post( [self]() {
+            boost::system::error_code ec;
+            self->socket->close( ec );
+            self->pending_message_buffer.reset();
+            self->outstanding_read_bytes.reset();
+            self->read_paused = false;
+         });
       }
       else {
          wlog("no socket to close!");
@@ -788,53 +858,46 @@ namespace eosio {
       my_impl->sync_master->reset_lib_num(shared_from_this());
       fc_dlog(logger, "canceling wait on ${p}", ("p",peer_name()));
       cancel_wait();
-      pending_message_buffer.reset();
    }
 
    void connection::txn_send_pending(const vector<transaction_id_type> &ids) {
-      for(auto tx = my_impl->local_txns.begin(); tx != my_impl->local_txns.end(); ++tx ){
-         if(tx->serialized_txn.size() && tx->block_num == 0) {
+      for(const auto& entry : my_impl->local_txns) {
+         const auto& tx = entry.second;
+         if(tx.serialized_txn && tx.block_num == 0) {
             bool found = false;
             for(auto known : ids) {
-               if( known == tx->id) {
+               if( known == tx.id) {
                   found = true;
                   break;
                }
             }
             if(!found) {
-               my_impl->local_txns.modify(tx,incr_in_flight);
-               queue_write(std::make_shared<vector<char>>(tx->serialized_txn),
-                           true,
-                           [tx_id=tx->id](boost::system::error_code ec, std::size_t ) {
-                              auto& local_txns = my_impl->local_txns;
-                              auto tx = local_txns.get<by_id>().find(tx_id);
-                              if (tx != local_txns.end()) {
-                                 local_txns.modify(tx, decr_in_flight);
-                              } else {
-                                 fc_wlog(logger, "Local pending TX erased before queued_write called callback");
-                              }
-                           });
+               known_trxs.insert(tx.id);
+               queue_write(tx.serialized_txn, true, transaction_priority, [](boost::system::error_code ec, std::size_t ) {});
             }
          }
       }
    }
 
+   void connection::send_trx_announce() {
+      if( pending_trx_announce.empty() ) {
+         return;
+      }
+      notice_message note;
+      note.known_blocks.mode = none;
+      note.known_trx.mode = normal;
+      note.known_trx.pending = pending_trx_announce.size();
+      note.known_trx.ids = std::move( pending_trx_announce );
+      pending_trx_announce.clear();
+      enqueue( note );
+   }
+
    void connection::txn_send(const vector<transaction_id_type> &ids) {
       for(auto t : ids) {
-         auto tx = my_impl->local_txns.get<by_id>().find(t);
-         if( tx != my_impl->local_txns.end() && tx->serialized_txn.size()) {
-            my_impl->local_txns.modify( tx,incr_in_flight);
-            queue_write(std::make_shared<vector<char>>(tx->serialized_txn),
-                        true,
-                        [t](boost::system::error_code ec, std::size_t ) {
-                           auto& local_txns = my_impl->local_txns;
-                           auto tx = local_txns.get<by_id>().find(t);
-                           if (tx != local_txns.end()) {
-                              local_txns.modify(tx, decr_in_flight);
-                           } else {
-                              fc_wlog(logger, "Local TX erased before queued_write called callback");
-                           }
-                        });
+         auto tx = my_impl->local_txns.find(t);
+         if( tx && tx->serialized_txn) {
+            known_trxs.insert(t);
+            queue_write(tx->serialized_txn, true, transaction_priority, [](boost::system::error_code ec, std::size_t ) {});
          }
       }
    }
@@ -889,7 +952,7 @@ namespace eosio {
          if (bstack.back()->previous == lib_id) {
             count = bstack.size();
             while (bstack.size()) {
-               enqueue(*bstack.back());
+               enqueue(*bstack.back(), true, block_priority);
                bstack.pop_back();
             }
          }
@@ -972,76 +1035,92 @@ namespace eosio {
 
    void connection::queue_write(std::shared_ptr<vector<char>> buff,
                                 bool trigger_send,
+                                send_priority priority,
                                 std::function<void(boost::system::error_code, std::size_t)> callback) {
-      write_queue.push_back({buff, callback});
+      write_queues.push(priority, {buff, callback});
+      ++messages_sent;
       if(out_queue.empty() && trigger_send)
          do_queue_write();
    }
 
    void connection::do_queue_write() {
-      if(write_queue.empty() || !out_queue.empty())
+      if(!out_queue.empty() || write_queue_size() == 0)
          return;
       connection_wptr c(shared_from_this());
-      if(!socket->is_open()) {
+      if(!socket_is_open()) {
          fc_elog(logger,"socket not open to ${p}",("p",peer_name()));
          my_impl->close(c.lock());
          return;
       }
+      write_queues.next_batch(out_queue);
       std::vector<boost::asio::const_buffer> bufs;
-      while (write_queue.size() > 0) {
-         auto& m = write_queue.front();
+      for (const auto& m : out_queue) {
          bufs.push_back(boost::asio::buffer(*m.buff));
-         out_queue.push_back(m);
-         write_queue.pop_front();
       }
-      boost::asio::async_write(*socket, bufs, [c](boost::system::error_code ec, std::size_t w) {
-            try {
-               auto conn = c.lock();
-               if(!conn)
-                  return;
+      // out_queue keeps the buffers alive until the completion is back on the application thread
+      uint32_t generation = session_generation;
+      strand.post( [conn = shared_from_this(), bufs, generation]() {
+         boost::asio::async_write( *conn->socket, bufs, conn->strand.wrap( [conn, generation]( boost::system::error_code ec, std::size_t w ) {
+            connection_wptr c( conn );
+            app().get_io_service().post( [c, ec, w, generation]() {
+               try {
+                  auto conn = c.lock();
+                  if(!conn)
+                     return;
 
-               for (auto& m: conn->out_queue) {
-                  m.callback(ec, w);
-               }
+                  if(generation != conn->session_generation) {
+                     // closed since; the buffers are released and the current session may write
+                     conn->out_queue.clear();
+                     if(conn->socket_is_open())
+                        conn->do_queue_write();
+                     return;
+                  }
 
-               if(ec) {
-                  string pname = conn ? conn->peer_name() : "no connection name";
-                  if( ec.value() != boost::asio::error::eof) {
-                     elog("Error sending to peer ${p}: ${i}", ("p",pname)("i", ec.message()));
+                  for (auto& m: conn->out_queue) {
+                     m.callback(ec, w);
                   }
-                  else {
-                     ilog("connection closure detected on write to ${p}",("p",pname));
+
+                  if(ec) {
+                     string pname = conn ? conn->peer_name() : "no connection name";
+                     if( ec.value() != boost::asio::error::eof) {
+                        elog("Error sending to peer ${p}: ${i}", ("p",pname)("i", ec.message()));
+                     }
+                     else {
+                        ilog("connection closure detected on write to ${p}",("p",pname));
+                     }
+                     my_impl->close(conn);
+                     return;
                   }
-                  my_impl->close(conn);
-                  return;
+                  conn->bytes_sent += w;
+                  while (conn->out_queue.size() > 0) {
+                     conn->out_queue.pop_front();
+                  }
+                  conn->enqueue_sync_block();
+                  conn->do_queue_write();
                }
-               while (conn->out_queue.size() > 0) {
-                  conn->out_queue.pop_front();
+               catch(const std::exception &ex) {
+                  auto conn = c.lock();
+                  string pname = conn ? conn->peer_name() : "no connection name";
+                  elog("Exception in do_queue_write to ${p} ${s}", ("p",pname)("s",ex.what()));
                }
-               conn->enqueue_sync_block();
-               conn->do_queue_write();
-            }
-            catch(const std::exception &ex) {
-               auto conn = c.lock();
-               string pname = conn ? conn->peer_name() : "no connection name";
-               elog("Exception in do_queue_write to ${p} ${s}", ("p",pname)("s",ex.what()));
-            }
-            catch(const fc::exception &ex) {
-               auto conn = c.lock();
-               string pname = conn ? conn->peer_name() : "no connection name";
-               elog("Exception in do_queue_write to ${p} ${s}", ("p",pname)("s",ex.to_string()));
-            }
-            catch(...) {
-               auto conn = c.lock();
-               string pname = conn ? conn->peer_name() : "no connection name";
-               elog("Exception in do_queue_write to ${p}", ("p",pname) );
-            }
-         });
+               catch(const fc::exception &ex) {
+                  auto conn = c.lock();
+                  string pname = conn ? conn->peer_name() : "no connection name";
+                  elog("Exception in do_queue_write to ${p} ${s}", ("p",pname)("s",ex.to_string()));
+               }
+               catch(...) {
+                  auto conn = c.lock();
+                  string pname = conn ? conn->peer_name() : "no connection name";
+                  elog("Exception in do_queue_write to ${p}", ("p",pname) );
+               }
+            });
+         }));
+      });
    }
 
    void connection::cancel_sync(go_away_reason reason) {
       fc_dlog(logger,"cancel sync reason = ${m}, write queue size ${o} peer ${p}",
-              ("m",reason_str(reason)) ("o", write_queue.size())("p", peer_name()));
+              ("m",reason_str(reason)) ("o", write_queue_size())("p", peer_name()));
       cancel_wait();
       flush_queues();
       switch (reason) {
@@ -1061,15 +1140,24 @@ namespace eosio {
       controller& cc = app().find_plugin<chain_plugin>()->chain();
       if (!peer_requested)
          return false;
-      uint32_t num = ++peer_requested->last;
+      // the next block is queued once the one being compressed is, keeping them in order
+      if (compressing_sync_block)
+         return true;
+      uint32_t num = peer_requested->last + 1;
       bool trigger_send = num == peer_requested->start_block;
-      if(num == peer_requested->end_block) {
-         peer_requested.reset();
-      }
       try {
+         // not advanced past a block that is not available yet, such as a head block still awaiting its signature
          signed_block_ptr sb = cc.fetch_block_by_number(num);
          if(sb) {
-            enqueue( *sb, trigger_send);
+            peer_requested->last = num;
+            if(num == peer_requested->end_block) {
+               peer_requested.reset();
+            }
+            if( my_impl->sync_compression && protocol_version >= proto_sync_compression ) {
+               compress_sync_block( sb );
+               return true;
+            }
+            enqueue( *sb, trigger_send, sync_priority );
             return true;
          }
       } catch ( ... ) {
@@ -1078,24 +1166,47 @@ namespace eosio {
       return false;
    }
 
+   void connection::compress_sync_block( const signed_block_ptr& sb ) {
+      compressing_sync_block = true;
+      connection_wptr weak_this = shared_from_this();
+      auto generation = flush_generation;
+      my_impl->thread_pool_ios->post( [weak_this, sb, generation, min_size = my_impl->sync_compression_min_size]() {
+         std::shared_ptr<vector<char>> send_buffer;
+         try {
+            send_buffer = create_sync_block_buffer( *sb, min_size );
+         } FC_LOG_AND_DROP()
+         app().get_io_service().post( [weak_this, sb, send_buffer, generation]() {
+            connection_ptr conn = weak_this.lock();
+            // queues flushed meanwhile: the peer no longer expects this block
+            if( !conn || conn->flush_generation != generation )
+               return;
+            conn->compressing_sync_block = false;
+            if( send_buffer ) {
+               conn->enqueue_buffer( send_buffer, true, no_reason, sync_priority );
+            } else {
+               conn->enqueue( *sb, true, sync_priority );
+            }
+         });
+      });
+   }
+
    void connection::enqueue( const net_message &m, bool trigger_send ) {
+      enqueue( m, trigger_send, priority_of( m ) );
+   }
+
+   void connection::enqueue( const net_message &m, bool trigger_send, send_priority priority ) {
       go_away_reason close_after_send = no_reason;
       if (m.contains<go_away_message>()) {
          close_after_send = m.get<go_away_message>().reason;
       }
 
-      uint32_t payload_size = fc::raw::pack_size( m );
-      char * header = reinterpret_cast<char*>(&payload_size);
-      size_t header_size = sizeof(payload_size);
-
-      size_t buffer_size = header_size + payload_size;
+      enqueue_buffer( create_send_buffer( m ), trigger_send, close_after_send, priority );
+   }
 
-      auto send_buffer = std::make_shared<vector<char>>(buffer_size);
-      fc::datastream<char*> ds( send_buffer->data(), buffer_size);
-      ds.write( header, header_size );
-      fc::raw::pack( ds, m );
+   void connection::enqueue_buffer( const std::shared_ptr<vector<char>>& send_buffer, bool trigger_send, go_away_reason close_after_send,
+                                    send_priority priority ) {
       connection_wptr weak_this = shared_from_this();
-      queue_write(send_buffer,trigger_send,
+      queue_write(send_buffer,trigger_send,priority,
                   [weak_this, close_after_send](boost::system::error_code ec, std::size_t ) {
                      connection_ptr conn = weak_this.lock();
                      if (conn) {
@@ -1188,35 +1299,55 @@ namespace eosio {
 
    bool connection::process_next_message(net_plugin_impl& impl, uint32_t message_length) {
       try {
-         // If it is a signed_block, then save the raw message for the cache
-         // This must be done before we unpack the message.
-         // This code is copied from fc::io::unpack(..., unsigned_int)
-         auto index = pending_message_buffer.read_index();
-         uint64_t which = 0; char b = 0; uint8_t by = 0;
-         do {
-            pending_message_buffer.peek(&b, 1, index);
-            which |= uint32_t(uint8_t(b) & 0x7f) << by;
-            by += 7;
-         } while( uint8_t(b) & 0x80 && by < 32);
-
-         if (which == uint64_t(net_message::tag<signed_block>::value)) {
-            blk_buffer.resize(message_length);
-            auto index = pending_message_buffer.read_index();
-            pending_message_buffer.peek(blk_buffer.data(), message_length, index);
-         }
+         // unpacked straight out of the read buffer chunks, without copying the message first
          auto ds = pending_message_buffer.create_datastream();
-         net_message msg;
-         fc::raw::unpack(ds, msg);
-         msgHandler m(impl, shared_from_this() );
-         msg.visit(m);
+         auto msg = std::make_shared<net_message>();
+         fc::raw::unpack(ds, *msg);
+         // inflated here on the network thread, the application thread only sees the signed_block
+         inflate_message( *msg );
+
+         // decoded on the network thread, handled on the application thread
+         connection_wptr weak_this = shared_from_this();
+         uint32_t generation = session_generation;
+         ++incoming_messages;
+         app().get_io_service().post( [&impl, weak_this, msg, generation]() {
+            auto c = weak_this.lock();
+            if( !c ) {
+               return;
+            }
+            if( c->incoming_messages-- == max_incoming_messages ) {
+               c->resume_read();
+            }
+            if( !c->socket_is_open() || generation != c->session_generation ) {
+               return;
+            }
+            try {
+               if( c->messages_received.size() <= size_t(msg->which()) )
+                  c->messages_received.resize( msg->which() + 1 );
+               ++c->messages_received[msg->which()];
+               msgHandler m( impl, c );
+               msg->visit( m );
+            } catch(  const fc::exception& e ) {
+               edump((e.to_detail_string() ));
+               impl.close( c );
+            }
+         });
       } catch(  const fc::exception& e ) {
-         edump((e.to_detail_string() ));
-         impl.close( shared_from_this() );
+         impl.close_on_app_thread( shared_from_this(), e.to_detail_string() );
          return false;
       }
       return true;
    }
 
+   void connection::resume_read() {
+      strand.post( [self = shared_from_this()]() {
+         if( self->read_paused && self->socket_is_open() ) {
+            self->read_paused = false;
+            my_impl->start_read_message( self );
+         }
+      });
+   }
+
    bool connection::add_peer_block(const peer_block_state &entry) {
       auto bptr = blk_state.get<by_id>().find(entry.id);
       bool added = (bptr == blk_state.end());
@@ -1237,11 +1368,12 @@ namespace eosio {
 
    //-----------------------------------------------------------
 
-    sync_manager::sync_manager( uint32_t req_span )
+    sync_manager::sync_manager( uint32_t req_span, uint32_t max_sources )
       :sync_known_lib_num( 0 )
       ,sync_last_requested_num( 0 )
       ,sync_next_expected_num( 1 )
       ,sync_req_span( req_span )
+      ,sync_max_sources( max_sources )
       ,source()
       ,state(in_sync)
    {
@@ -1279,13 +1411,14 @@ namespace eosio {
    void sync_manager::reset_lib_num(connection_ptr c) {
       if(state == in_sync) {
          source.reset();
+         chunks.clear();
       }
       if( c->current() ) {
          if( c->last_handshake_recv.last_irreversible_block_num > sync_known_lib_num) {
             sync_known_lib_num =c->last_handshake_recv.last_irreversible_block_num;
          }
-      } else if( c == source ) {
-         sync_last_requested_num = 0;
+      } else if( chunks.is_source(c) ) {
+         chunks.release(c);
          request_next_chunk();
       }
    }
@@ -1298,90 +1431,99 @@ namespace eosio {
               chain_plug->chain( ).fork_db_head_block_num( ) < sync_last_requested_num );
    }
 
-   void sync_manager::request_next_chunk( connection_ptr conn ) {
-      uint32_t head_block = chain_plug->chain().fork_db_head_block_num();
-
-      if (head_block < sync_last_requested_num && source && source->current()) {
-         fc_ilog (logger, "ignoring request, head is ${h} last req = ${r} source is ${p}",
-                  ("h",head_block)("r",sync_last_requested_num)("p",source->peer_name()));
-         return;
+   connection_ptr sync_manager::next_idle_source(const connection_ptr& preferred) {
+      auto idle = [this](const connection_ptr& c) {
+         return c && c->current() && !chunks.is_source(c);
+      };
+      if (idle(preferred)) {
+         return preferred;
       }
+      // round robin among equals, starting after the last peer a range was requested from
+      const auto& conns = my_impl->connections;
+      auto first = source ? conns.upper_bound(source) : conns.begin();
+      auto best = fastest_peer(conns.begin(), first, conns.end(), idle,
+                               [](const connection_ptr& c) { return c->rtt_us; });
+      return best != conns.end() ? *best : connection_ptr();
+   }
 
+   void sync_manager::request_chunk(const sync_chunk& chunk, const connection_ptr& c) {
+      fc_ilog(logger, "requesting range ${s} to ${e}, from ${n}",
+              ("n",c->peer_name())("s",chunk.next)("e",chunk.end));
+      source = c;
+      c->request_sync_blocks(chunk.next, chunk.end);
+   }
+
+   void sync_manager::request_next_chunk( connection_ptr conn ) {
       /* ----------
        * next chunk provider selection criteria
        * a provider is supplied and able to be used, use it.
        * otherwise select the next available from the list, round-robin style.
+       *
+       * up to sync_max_sources peers each work on their own range at once; the rest of a range whose
+       * provider went away is handed out before any new range.
        */
 
-      if (conn && conn->current() ) {
-         source = conn;
-      }
-      else {
-         if (my_impl->connections.size() == 1) {
-            if (!source) {
-               source = *my_impl->connections.begin();
-            }
-         }
-         else {
-            // init to a linear array search
-            auto cptr = my_impl->connections.begin();
-            auto cend = my_impl->connections.end();
-            // do we remember the previous source?
-            if (source) {
-               //try to find it in the list
-               cptr = my_impl->connections.find(source);
-               cend = cptr;
-               if (cptr == my_impl->connections.end()) {
-                  //not there - must have been closed! cend is now connections.end, so just flatten the ring.
-                  source.reset();
-                  cptr = my_impl->connections.begin();
-               } else {
-                  //was found - advance the start to the next. cend is the old source.
-                  if (++cptr == my_impl->connections.end() && cend != my_impl->connections.end() ) {
-                     cptr = my_impl->connections.begin();
-                  }
-               }
-            }
-
-            //scan the list of peers looking for another able to provide sync blocks.
-            while (cptr != cend) {
-               //select the first one which is current and break out.
-               if ((*cptr)->current()) {
-                  source = *cptr;
-                  break;
-               }
-               else {
-                  // advance the iterator in a round robin fashion.
-                  if (++cptr == my_impl->connections.end()) {
-                     cptr = my_impl->connections.begin();
-                  }
-               }
-            }
-            // no need to check the result, either source advanced or the whole list was checked and the old source is reused.
-         }
-      }
+      size_t busy = chunks.schedule(sync_next_expected_num, sync_last_requested_num, sync_known_lib_num,
+                                    sync_req_span, sync_max_sources,
+                                    [&]() { return next_idle_source(conn); },
+                                    [this](const sync_chunk& chunk, const connection_ptr& c) { request_chunk(chunk, c); });
 
       // verify there is an available source
-      if (!source || !source->current() ) {
+      if (busy == 0 && sync_next_expected_num <= sync_known_lib_num) {
          elog("Unable to continue syncing at this time");
          sync_known_lib_num = chain_plug->chain().last_irreversible_block_num();
          sync_last_requested_num = 0;
+         chunks.clear();
          set_state(in_sync); // probably not, but we can't do anything else
+      }
+   }
+
+   void sync_manager::chunk_progress(const connection_ptr& c, uint32_t blk_num) {
+      auto p = chunks.advance(c, blk_num);
+      if (p == sync_chunks::progress::none) {
+         return;
+      }
+      if (p == sync_chunks::progress::ongoing) {
+         c->sync_wait();
          return;
       }
 
-      if( sync_last_requested_num != sync_known_lib_num ) {
-         uint32_t start = sync_next_expected_num;
-         uint32_t end = start + sync_req_span - 1;
-         if( end > sync_known_lib_num )
-            end = sync_known_lib_num;
-         if( end > 0 && end >= start ) {
-            fc_ilog(logger, "requesting range ${s} to ${e}, from ${n}",
-                    ("n",source->peer_name())("s",start)("e",end));
-            source->request_sync_blocks(start, end);
-            sync_last_requested_num = end;
-         }
+      if (auto head = chunks.takeover(c, sync_req_span)) {
+         fc_ilog(logger, "moving blocks ${s} to ${e} from ${o} to faster peer ${p}",
+                 ("s",head->next)("e",head->end)("o",head->source->peer_name())("p",c->peer_name()));
+         head->source->cancel_sync(benign_other);
+         sync_chunks::assign(*head, head->next, c);
+         request_chunk(*head, c);
+         return;
+      }
+      request_next_chunk(c);
+   }
+
+   bool sync_manager::buffer_early_block(connection_ptr c, const signed_block& blk) {
+      if (state != lib_catchup) {
+         return false;
+      }
+      uint32_t blk_num = blk.block_num();
+      switch (chunks.buffer(c, blk, sync_next_expected_num, sync_last_requested_num)) {
+         case sync_chunks::arrival::apply:
+            // not ahead of the ranges still being requested, left to recv_block
+            return false;
+         case sync_chunks::arrival::ignored:
+            fc_dlog(logger, "ignoring block #${n} from ${p}, not the source of its range", ("n",blk_num)("p",c->peer_name()));
+            return true;
+         case sync_chunks::arrival::buffered:
+            break;
+      }
+      c->cancel_wait();
+      chunk_progress(c, blk_num);
+      return true;
+   }
+
+   bool sync_manager::next_early_block(connection_ptr& c, signed_block_ptr& blk) {
+      if (state != lib_catchup) {
+         return false;
       }
+      return chunks.next_early(sync_next_expected_num, c, blk);
    }
 
    void sync_manager::send_handshakes ()
@@ -1409,6 +1551,8 @@ namespace eosio {
       if (state == in_sync) {
          set_state(lib_catchup);
          sync_next_expected_num = chain_plug->chain().last_irreversible_block_num() + 1;
+         sync_last_requested_num = sync_next_expected_num - 1;
+         chunks.clear();
       }
 
       fc_ilog(logger, "Catching up with chain, our last req is ${cc}, theirs is ${t} peer ${p}",
@@ -1421,9 +1565,9 @@ namespace eosio {
       fc_ilog(logger, "reassign_fetch, our last req is ${cc}, next expected is ${ne} peer ${p}",
               ( "cc",sync_last_requested_num)("ne",sync_next_expected_num)("p",c->peer_name()));
 
-      if (c == source) {
+      if (chunks.is_source(c)) {
          c->cancel_sync (reason);
-         sync_last_requested_num = 0;
+         chunks.release(c);
          request_next_chunk();
       }
    }
@@ -1547,8 +1691,14 @@ namespace eosio {
    void sync_manager::rejected_block (connection_ptr c, uint32_t blk_num) {
       if (state != in_sync ) {
          fc_ilog (logger, "block ${bn} not accepted from ${p}",("bn",blk_num)("p",c->peer_name()));
+         for (const auto& ch : chunks.ranges()) {
+            if (ch.second.source && ch.second.source != c) {
+               ch.second.source->cancel_sync(benign_other);
+            }
+         }
          sync_last_requested_num = 0;
          source.reset();
+         chunks.clear();
          my_impl->close(c);
          set_state(in_sync);
          send_handshakes();
@@ -1557,6 +1707,11 @@ namespace eosio {
    void sync_manager::recv_block (connection_ptr c, const block_id_type &blk_id, uint32_t blk_num) {
       fc_dlog(logger," got block ${bn} from ${p}",("bn",blk_num)("p",c->peer_name()));
       if (state == lib_catchup) {
+         if (blk_num < sync_next_expected_num) {
+            // part of a range that was moved to another peer, which got here first
+            fc_dlog(logger, "already have block ${bn} from ${p}",("bn",blk_num)("p",c->peer_name()));
+            return;
+         }
          if (blk_num != sync_next_expected_num) {
             fc_ilog (logger, "expected block ${ne} but got ${bn}",("ne",sync_next_expected_num)("bn",blk_num));
             my_impl->close(c);
@@ -1587,14 +1742,11 @@ namespace eosio {
          if( blk_num == sync_known_lib_num ) {
             fc_dlog( logger, "All caught up with last known last irreversible block resending handshake");
             set_state(in_sync);
+            chunks.clear();
             send_handshakes();
          }
-         else if (blk_num == sync_last_requested_num) {
-            request_next_chunk();
-         }
          else {
-            fc_dlog(logger,"calling sync_wait on connection ${p}",("p",c->peer_name()));
-            c->sync_wait();
+            chunk_progress(c, blk_num);
          }
       }
    }
@@ -1602,6 +1754,14 @@ namespace eosio {
    //------------------------------------------------------------------------
 
    void dispatch_manager::bcast_block (const signed_block &bsum) {
+      auto relayed = relayed_blocks.equal_range(bsum.block_num());
+      for (auto itr = relayed.first; itr != relayed.second; ++itr) {
+         if (itr->second == bsum.id()) {
+            relayed_blocks.erase(itr);
+            return;
+         }
+      }
+
       std::set<connection_ptr> skips;
       auto range = received_blocks.equal_range(bsum.id());
       for (auto org = range.first; org != range.second; ++org) {
@@ -1636,16 +1796,50 @@ namespace eosio {
       }
       else {
          pbstate.is_known = true;
-         for (auto cp : my_impl->connections) {
+         std::shared_ptr<vector<char>> compact_buffer;
+         if (my_impl->compact_block_relay) {
+            compact_block_message cb = make_compact_block(bsum, my_impl->local_txns);
+            if (!cb.compacted.empty()) {
+               compact_buffer = create_send_buffer( cb );
+            }
+         }
+         std::shared_ptr<vector<char>> send_buffer;
+         for (auto cp : my_impl->connections_by_latency()) {
             if (skips.find(cp) != skips.end() || !cp->current()) {
                continue;
             }
             cp->add_peer_block(pbstate);
-            cp->enqueue( bsum );
+            if (compact_buffer && cp->protocol_version >= proto_compact_blocks) {
+               cp->enqueue_buffer( compact_buffer, true, no_reason, block_priority );
+               continue;
+            }
+            if (!send_buffer) {
+               send_buffer = create_send_buffer( msg );
+            }
+            cp->enqueue_buffer( send_buffer, true, no_reason, block_priority );
          }
       }
    }
 
+   void dispatch_manager::relay_validated_header (const signed_block& bsum) {
+      auto relayed = relayed_blocks.equal_range(bsum.block_num());
+      for (auto itr = relayed.first; itr != relayed.second; ++itr) {
+         if (itr->second == bsum.id()) {
+            return;
+         }
+      }
+      try {
+         if (!relayable_header(my_impl->chain_plug->chain(), bsum)) {
+            return;
+         }
+      } catch (const fc::exception& ex) {
+         fc_dlog(logger, "not relaying block #${n} ahead of validation: ${m}", ("n",bsum.block_num())("m",ex.to_string()));
+         return;
+      }
+      bcast_block(bsum);
+      relayed_blocks.emplace(bsum.block_num(), bsum.id());
+   }
+
    void dispatch_manager::recv_block (connection_ptr c, const block_id_type& id, uint32_t bnum) {
       received_blocks.insert(std::make_pair(id, c));
       if (c &&
@@ -1677,75 +1871,47 @@ namespace eosio {
       }
       received_transactions.erase(range.first, range.second);
 
-      for (auto ref = req_trx.begin(); ref != req_trx.end(); ++ref) {
-         if (*ref == id) {
-            req_trx.erase(ref);
-            break;
-         }
-      }
+      req_trx.erase(id);
 
-      if( my_impl->local_txns.get<by_id>().find( id ) != my_impl->local_txns.end( ) ) { //found
+      if( my_impl->local_txns.find( id ) ) { //found
          fc_dlog(logger, "found trxid in local_trxs" );
          return;
       }
-      uint32_t packsiz = 0;
-      uint32_t bufsiz = 0;
-
       time_point_sec trx_expiration = trx.expiration();
 
-      net_message msg(trx);
-      packsiz = fc::raw::pack_size(msg);
-      bufsiz = packsiz + sizeof(packsiz);
-      vector<char> buff(bufsiz);
-      fc::datastream<char*> ds( buff.data(), bufsiz);
-      ds.write( reinterpret_cast<char*>(&packsiz), sizeof(packsiz) );
-      fc::raw::pack( ds, msg );
+      // the same buffer is kept for later requests and queued on every peer it is broadcast to
+      auto send_buffer = create_send_buffer( net_message(trx) );
+      auto bufsiz = send_buffer->size();
       node_transaction_state nts = {id,
                                     trx_expiration,
                                     trx,
-                                    std::move(buff),
-                                    0, 0, 0};
+                                    send_buffer,
+                                    0};
       my_impl->local_txns.insert(std::move(nts));
 
-      if( !large_msg_notify || bufsiz <= just_send_it_max) {
-         my_impl->send_all( trx, [id, &skips, trx_expiration](connection_ptr c) -> bool {
-               if( skips.find(c) != skips.end() || c->syncing ) {
-                  return false;
-               }
-               const auto& bs = c->trx_state.find(id);
-               bool unknown = bs == c->trx_state.end();
-               if( unknown) {
-                  c->trx_state.insert(transaction_state({id,true,true,0,trx_expiration,time_point() }));
-                  fc_dlog(logger, "sending whole trx to ${n}", ("n",c->peer_name() ) );
-               } else {
-                  update_txn_expiry ute(trx_expiration);
-                  c->trx_state.modify(bs, ute);
-               }
-               return unknown;
-            });
-      }
-      else {
-         notice_message pending_notify;
-         pending_notify.known_trx.mode = normal;
-         pending_notify.known_trx.ids.push_back( id );
-         pending_notify.known_blocks.mode = none;
-         my_impl->send_all(pending_notify, [id, &skips, trx_expiration](connection_ptr c) -> bool {
-               if (skips.find(c) != skips.end() || c->syncing) {
+      if( txn_announce_window.count() == 0 && (!large_msg_notify || bufsiz <= just_send_it_max) ) {
+         my_impl->send_all( send_buffer, transaction_priority, [id, &skips](connection_ptr c) -> bool {
+               if( skips.find(c) != skips.end() || c->syncing || c->known_trxs.contains(id) ) {
                   return false;
                }
-               const auto& bs = c->trx_state.find(id);
-               bool unknown = bs == c->trx_state.end();
-               if( unknown) {
-                  fc_dlog(logger, "sending notice to ${n}", ("n",c->peer_name() ) );
-                  c->trx_state.insert(transaction_state({id,false,true,0,trx_expiration,time_point() }));
-               } else {
-                  update_txn_expiry ute(trx_expiration);
-                  c->trx_state.modify(bs, ute);
-               }
-               return unknown;
+               c->known_trxs.insert(id);
+               fc_dlog(logger, "sending whole trx to ${n}", ("n",c->peer_name() ) );
+               return true;
             });
+         return;
       }
 
+      // announce the id, peers that do not have the transaction yet request it
+      for (const auto& c : my_impl->connections) {
+         if (skips.find(c) != skips.end() || c->syncing || !c->current() || c->known_trxs.contains(id)) {
+            continue;
+         }
+         c->pending_trx_announce.push_back(id);
+         if (txn_announce_window.count() == 0 || c->pending_trx_announce.size() >= txn_announce_max_ids) {
+            c->send_trx_announce();
+         }
+      }
+      my_impl->start_announce_timer();
    }
 
    void dispatch_manager::recv_transaction (connection_ptr c, const transaction_id_type& id) {
@@ -1766,6 +1932,7 @@ namespace eosio {
       fc_dlog(logger,"not sending rejected transaction ${tid}",("tid",id));
       auto range = received_transactions.equal_range(id);
       received_transactions.erase(range.first, range.second);
+      req_trx.erase(id);
    }
 
    void dispatch_manager::recv_notice (connection_ptr c, const notice_message& msg, bool generated) {
@@ -1777,24 +1944,11 @@ namespace eosio {
       if (msg.known_trx.mode == normal) {
          req.req_trx.mode = normal;
          req.req_trx.pending = 0;
-         for( const auto& t : msg.known_trx.ids ) {
-            const auto &tx = my_impl->local_txns.get<by_id>( ).find( t );
-
-            if( tx == my_impl->local_txns.end( ) ) {
-               fc_dlog(logger,"did not find ${id}",("id",t));
-
-               //At this point the details of the txn are not known, just its id. This
-               //effectively gives 120 seconds to learn of the details of the txn which
-               //will update the expiry in bcast_transaction
-               c->trx_state.insert( (transaction_state){t,true,true,0,time_point_sec(time_point::now()) + 120,
-                        time_point()} );
-
-               req.req_trx.ids.push_back( t );
-               req_trx.push_back( t );
-            }
-            else {
-               fc_dlog(logger,"big msg manager found txn id in table, ${id}",("id", t));
-            }
+         //At this point the details of the txns are not known, just their ids. This
+         //effectively gives 120 seconds to receive them from some peer
+         auto expires = time_point_sec(time_point::now()) + 120;
+         if( !req_trx.select( msg.known_trx.ids, my_impl->local_txns, c->known_trxs, expires, req.req_trx.ids ) ) {
+            peer_wlog(c, "ignoring announced transactions, already requested ${n}", ("n",req_trx.size()));
          }
          send_req = !req.req_trx.ids.empty();
          fc_dlog(logger,"big msg manager send_req ids list has ${ids} entries", ("ids", req.req_trx.ids.size()));
@@ -1858,26 +2012,30 @@ namespace eosio {
                   ("b",modes_str(c->last_req->req_blocks.mode))("t",modes_str(c->last_req->req_trx.mode)));
          return;
       }
+      connection_ptr best;
       for (auto conn : my_impl->connections) {
          if (conn == c || conn->last_req) {
             continue;
          }
          bool sendit = false;
          if (is_txn) {
-            auto trx = conn->trx_state.get<by_id>().find(tid);
-            sendit = trx != conn->trx_state.end() && trx->is_known_by_peer;
+            sendit = conn->known_trxs.contains(tid);
          }
          else {
             auto blk = conn->blk_state.get<by_id>().find(bid);
             sendit = blk != conn->blk_state.end() && blk->is_known;
          }
-         if (sendit) {
-            conn->enqueue(*c->last_req);
-            conn->fetch_wait();
-            conn->last_req = c->last_req;
-            return;
+         // of the peers that have it, ask the one with the shortest round trip
+         if (sendit && (!best || best->slower_than(conn))) {
+            best = conn;
          }
       }
+      if (best) {
+         best->enqueue(*c->last_req);
+         best->fetch_wait();
+         best->last_req = c->last_req;
+         return;
+      }
 
       // at this point no other peer has it, re-request or do nothing?
       if( c->connected() ) {
@@ -1939,31 +2097,41 @@ namespace eosio {
       ++endpoint_itr;
       c->connecting = true;
       connection_wptr weak_conn = c;
-      c->socket->async_connect( current_endpoint, [weak_conn, endpoint_itr, this] ( const boost::system::error_code& err ) {
+      c->strand.post( [weak_conn, current_endpoint, endpoint_itr, this]() {
+         auto c = weak_conn.lock();
+         if (!c) return;
+         c->socket->async_connect( current_endpoint, c->strand.wrap( [weak_conn, endpoint_itr, this] ( const boost::system::error_code& err ) {
             auto c = weak_conn.lock();
             if (!c) return;
-            if( !err && c->socket->is_open() ) {
-               if (start_session( c )) {
-                  c->send_handshake ();
-               }
-            } else {
-               if( endpoint_itr != tcp::resolver::iterator() ) {
-                  close(c);
-                  connect( c, endpoint_itr );
-               }
-               else {
-                  elog( "connection failed to ${peer}: ${error}",
-                        ( "peer", c->peer_name())("error",err.message()));
-                  c->connecting = false;
-                  my_impl->close(c);
+            bool connected = !err && c->socket->is_open();
+            app().get_io_service().post( [weak_conn, endpoint_itr, connected, err, this]() {
+               auto c = weak_conn.lock();
+               if (!c) return;
+               if( connected ) {
+                  if (start_session( c )) {
+                     c->send_handshake ();
+                  }
+               } else {
+                  if( endpoint_itr != tcp::resolver::iterator() ) {
+                     close(c);
+                     connect( c, endpoint_itr );
+                  }
+                  else {
+                     elog( "connection failed to ${peer}: ${error}",
+                           ( "peer", c->peer_name())("error",err.message()));
+                     c->connecting = false;
+                     my_impl->close(c);
+                  }
                }
-            }
-         } );
+            });
+         } ) );
+      });
    }
 
    bool net_plugin_impl::start_session( connection_ptr con ) {
       boost::asio::ip::tcp::no_delay nodelay( true );
       boost::system::error_code ec;
+      // no operation is outstanding on the socket until the read loop is started below
       con->socket->set_option( nodelay, ec );
       if (ec) {
          elog( "connection failed to ${peer}: ${error}",
@@ -1973,33 +2141,38 @@ namespace eosio {
          return false;
       }
       else {
-         start_read_message( con );
+         auto rep = con->socket->remote_endpoint( ec );
+         con->remote_endpoint = ec ? optional<tcp::endpoint>() : optional<tcp::endpoint>( rep );
+         auto lep = con->socket->local_endpoint( ec );
+         con->local_endpoint = ec ? optional<tcp::endpoint>() : optional<tcp::endpoint>( lep );
+         con->_logger_variant.reset();
+         con->socket_open = true;
+         con->strand.post( [this, con]() {
+            start_read_message( con );
+         });
          ++started_sessions;
          return true;
-         // for now, we can just use the application main loop.
-         //     con->readloop_complete  = bf::async( [=](){ read_loop( con ); } );
-         //     con->writeloop_complete = bf::async( [=](){ write_loop con ); } );
       }
    }
 
 
    void net_plugin_impl::start_listen_loop( ) {
-      auto socket = std::make_shared<tcp::socket>( std::ref( app().get_io_service() ) );
+      auto socket = std::make_shared<tcp::socket>( std::ref( *thread_pool_ios ) );
       acceptor->async_accept( *socket, [socket,this]( boost::system::error_code ec ) {
             if( !ec ) {
                uint32_t visitors = 0;
                uint32_t from_addr = 0;
+               // no operation is outstanding on the new socket yet
                auto paddr = socket->remote_endpoint(ec).address();
                if (ec) {
                   fc_elog(logger,"Error getting remote endpoint: ${m}",("m", ec.message()));
                }
                else {
                   for (auto &conn : connections) {
-                     if(conn->socket->is_open()) {
+                     if(conn->socket_is_open()) {
                         if (conn->peer_addr.empty()) {
                            visitors++;
-                           boost::system::error_code ec;
-                           if (paddr == conn->socket->remote_endpoint(ec).address()) {
+                           if (conn->remote_endpoint && paddr == conn->remote_endpoint->address()) {
                               from_addr++;
                            }
                         }
@@ -2047,6 +2220,7 @@ namespace eosio {
          });
    }
 
+   // runs on the connection's strand
    void net_plugin_impl::start_read_message( connection_ptr conn ) {
 
       try {
@@ -2054,6 +2228,7 @@ namespace eosio {
             return;
          }
          connection_wptr weak_conn = conn;
+         uint32_t generation = conn->session_generation;
 
          std::size_t minimum_read = conn->outstanding_read_bytes ? *conn->outstanding_read_bytes : message_header_size;
 
@@ -2074,9 +2249,10 @@ namespace eosio {
 
          boost::asio::async_read(*conn->socket,
             conn->pending_message_buffer.get_buffer_sequence_for_boost_async_read(), completion_handler,
-            [this,weak_conn]( boost::system::error_code ec, std::size_t bytes_transferred ) {
+            conn->strand.wrap( [this,weak_conn,generation]( boost::system::error_code ec, std::size_t bytes_transferred ) {
                auto conn = weak_conn.lock();
-               if (!conn) {
+               // a completion queued before close() must not touch the buffer reset since, or the next session
+               if (!conn || generation != conn->session_generation) {
                   return;
                }
 
@@ -2090,6 +2266,7 @@ namespace eosio {
                      }
                      EOS_ASSERT(bytes_transferred <= conn->pending_message_buffer.bytes_to_write(), plugin_exception, "");
                      conn->pending_message_buffer.advance_write_ptr(bytes_transferred);
+                     conn->bytes_received += bytes_transferred;
                      while (conn->pending_message_buffer.bytes_to_read() > 0) {
                         uint32_t bytes_in_buffer = conn->pending_message_buffer.bytes_to_read();
 
@@ -2101,9 +2278,7 @@ namespace eosio {
                            auto index = conn->pending_message_buffer.read_index();
                            conn->pending_message_buffer.peek(&message_length, sizeof(message_length), index);
                            if(message_length > def_send_buffer_size*2 || message_length == 0) {
-                              boost::system::error_code ec;
-                              elog("incoming message length unexpected (${i}), from ${p}", ("i", message_length)("p",boost::lexical_cast<std::string>(conn->socket->remote_endpoint(ec))));
-                              close(conn);
+                              close_on_app_thread(conn, "incoming message length unexpected (" + std::to_string(message_length) + ")");
                               return;
                            }
 
@@ -2126,37 +2301,42 @@ namespace eosio {
                            }
                         }
                      }
-                     start_read_message(conn);
-                  } else {
-                     auto pname = conn->peer_name();
-                     if (ec.value() != boost::asio::error::eof) {
-                        elog( "Error reading message from ${p}: ${m}",("p",pname)( "m", ec.message() ) );
+                     if (generation != conn->session_generation) {
+                        return;
+                     }
+                     if (conn->incoming_messages >= max_incoming_messages) {
+                        // resumed by the application thread once it caught up
+                        conn->read_paused = true;
                      } else {
-                        ilog( "Peer ${p} closed connection",("p",pname) );
+                        start_read_message(conn);
                      }
-                     close( conn );
+                  } else if (ec.value() != boost::asio::error::operation_aborted) {
+                     // aborted reads are the result of close(), anything else closes the connection
+                     app().get_io_service().post( [this, weak_conn, ec]() {
+                        auto conn = weak_conn.lock();
+                        if (!conn) return;
+                        auto pname = conn->peer_name();
+                        if (ec.value() != boost::asio::error::eof) {
+                           elog( "Error reading message from ${p}: ${m}",("p",pname)( "m", ec.message() ) );
+                        } else {
+                           ilog( "Peer ${p} closed connection",("p",pname) );
+                        }
+                        close( conn );
+                     });
                   }
                }
                catch(const std::exception &ex) {
-                  string pname = conn ? conn->peer_name() : "no connection name";
-                  elog("Exception in handling read data from ${p} ${s}",("p",pname)("s",ex.what()));
-                  close( conn );
+                  close_on_app_thread( conn, string("Exception in handling read data: ") + ex.what() );
                }
                catch(const fc::exception &ex) {
-                  string pname = conn ? conn->peer_name() : "no connection name";
-                  elog("Exception in handling read data ${s}", ("p",pname)("s",ex.to_string()));
-                  close( conn );
+                  close_on_app_thread( conn, "Exception in handling read data: " + ex.to_string() );
                }
                catch (...) {
-                  string pname = conn ? conn->peer_name() : "no connection name";
-                  elog( "Undefined exception hanlding the read data from connection ${p}",( "p",pname));
-                  close( conn );
+                  close_on_app_thread( conn, "Undefined exception handling the read data" );
                }
-            } );
+            } ) );
       } catch (...) {
-         string pname = conn ? conn->peer_name() : "no connection name";
-         elog( "Undefined exception handling reading ${p}",("p",pname) );
-         close( conn );
+         close_on_app_thread( conn, "Undefined exception handling reading" );
       }
    }
 
@@ -2164,18 +2344,38 @@ namespace eosio {
    {
       size_t count = 0;
       for( auto &c : connections) {
-         if(c->socket->is_open())
+         if(c->socket_is_open())
             ++count;
       }
       return count;
    }
 
 
+   vector<connection_ptr> net_plugin_impl::connections_by_latency() const {
+      vector<connection_ptr> result( connections.begin(), connections.end() );
+      sort_by_latency( result, []( const connection_ptr& c ) { return c->rtt_us; } );
+      return result;
+   }
+
    template<typename VerifierFunc>
    void net_plugin_impl::send_all( const net_message &msg, VerifierFunc verify) {
-      for( auto &c : connections) {
+      // serialized once, on the first connection it is sent to
+      std::shared_ptr<vector<char>> send_buffer;
+      for( auto &c : connections_by_latency()) {
          if( c->current() && verify( c)) {
-            c->enqueue( msg );
+            if( !send_buffer ) {
+               send_buffer = create_send_buffer( msg );
+            }
+            c->enqueue_buffer( send_buffer, true, no_reason, priority_of( msg ) );
+         }
+      }
+   }
+
+   template<typename VerifierFunc>
+   void net_plugin_impl::send_all( const std::shared_ptr<vector<char>>& send_buffer, send_priority priority, VerifierFunc verify) {
+      for( auto &c : connections_by_latency()) {
+         if( c->current() && verify( c)) {
+            c->enqueue_buffer( send_buffer, true, no_reason, priority );
          }
       }
    }
@@ -2356,6 +2556,8 @@ namespace eosio {
 
       c->offset = (double(c->rec - c->org) + double(msg.xmt - c->dst)) / 2;
       double NsecPerUsec{1000};
+      // time on the wire both ways, without the time the peer held on to our message
+      c->record_round_trip( int64_t( ((msg.dst - msg.org) - (msg.xmt - msg.rec)) / NsecPerUsec ) );
 
       if(logger.is_enabled(fc::log_level::all))
          logger.log(FC_LOG_MESSAGE(all, "Clock offset is ${o}ns (${us}us)", ("o", c->offset)("us", c->offset/NsecPerUsec)));
@@ -2387,11 +2589,9 @@ namespace eosio {
             // plan to get all except what we already know about.
             req.req_trx.mode = catch_up;
             send_req = true;
-            size_t known_sum = local_txns.size();
-            if( known_sum ) {
-               for( const auto& t : local_txns.get<by_id>( ) ) {
-                  req.req_trx.ids.push_back( t.id );
-               }
+            req.req_trx.ids.reserve( local_txns.size() );
+            for( const auto& t : local_txns ) {
+               req.req_trx.ids.push_back( t.first );
             }
          }
          break;
@@ -2484,7 +2684,7 @@ namespace eosio {
       }
       transaction_id_type tid = msg.id();
       c->cancel_wait();
-      if(local_txns.get<by_id>().find(tid) != local_txns.end()) {
+      if(local_txns.find(tid)) {
          fc_dlog(logger, "got a duplicate transaction - dropping");
          return;
       }
@@ -2512,6 +2712,21 @@ namespace eosio {
    }
 
    void net_plugin_impl::handle_message( connection_ptr c, const signed_block &msg) {
+      if( sync_master->buffer_early_block(c, msg) ) {
+         return;
+      }
+      process_block(c, std::make_shared<signed_block>(msg));
+
+      // blocks of later ranges that other peers delivered first can go in now, in order
+      connection_ptr from;
+      signed_block_ptr early;
+      while( sync_master->next_early_block(from, early) ) {
+         process_block(from, early);
+      }
+   }
+
+   void net_plugin_impl::process_block( connection_ptr c, const signed_block_ptr& sbp) {
+      const signed_block& msg = *sbp;
       controller &cc = chain_plug->chain();
       block_id_type blk_id = msg.id();
       uint32_t blk_num = msg.block_num();
@@ -2529,13 +2744,15 @@ namespace eosio {
       }
 
       dispatcher->recv_block(c, blk_id, blk_num);
+      if( header_validated_relay && !sync_master->is_active(c) ) {
+         dispatcher->relay_validated_header(msg);
+      }
       fc::microseconds age( fc::time_point::now() - msg.timestamp);
       peer_ilog(c, "received signed_block : #${n} block age in secs = ${age}",
               ("n",blk_num)("age",age.to_seconds()));
 
       go_away_reason reason = fatal_other;
       try {
-         signed_block_ptr sbp = std::make_shared<signed_block>(msg);
          chain_plug->accept_block(sbp); //, sync_master->is_active(c));
          reason = no_reason;
       } catch( const unlinkable_block_exception &ex) {
@@ -2557,18 +2774,13 @@ namespace eosio {
          elog( "handle sync block caught something else from ${p}",("num",blk_num)("p",c->peer_name()));
       }
 
-      update_block_num ubn(blk_num);
       if( reason == no_reason ) {
+         if( !sync_master->is_active(c) ) {
+            c->record_block_lag( age );
+         }
          for (const auto &recpt : msg.transactions) {
             auto id = (recpt.trx.which() == 0) ? recpt.trx.get<transaction_id_type>() : recpt.trx.get<packed_transaction>().id();
-            auto ltx = local_txns.get<by_id>().find(id);
-            if( ltx != local_txns.end()) {
-               local_txns.modify( ltx, ubn );
-            }
-            auto ctx = c->trx_state.get<by_id>().find(id);
-            if( ctx != c->trx_state.end()) {
-               c->trx_state.modify( ctx, ubn );
-            }
+            local_txns.set_block_num( id, blk_num );
          }
          sync_master->recv_block(c, blk_id, blk_num);
       }
@@ -2577,6 +2789,106 @@ namespace eosio {
       }
    }
 
+   void net_plugin_impl::handle_message( connection_ptr c, const compact_block_message &msg) {
+      signed_block block = msg.block;
+      block_id_type blk_id = block.id();
+      uint32_t blk_num = block.block_num();
+      peer_ilog(c, "received compact_block_message : #${n} with ${c} of ${t} transactions by id",
+                ("n",blk_num)("c",msg.compacted.size())("t",block.transactions.size()));
+
+      vector<uint32_t> missing;
+      if (!fill_compact_block(block, msg.compacted, local_txns, missing)) {
+         peer_elog(c, "bad compact_block_message : invalid transaction index");
+         close(c);
+         return;
+      }
+
+      if (missing.empty()) {
+         accept_compact_block(c, block);
+         return;
+      }
+
+      try {
+         if (chain_plug->chain().fetch_block_by_id(blk_id)) {
+            c->cancel_wait();
+            sync_master->recv_block(c, blk_id, blk_num);
+            return;
+         }
+      } catch( ...) {
+         elog("Caught an unknown exception trying to recall blockID");
+      }
+
+      fc_dlog(logger, "requesting ${m} missing transactions of block #${n} from ${p}",
+              ("m",missing.size())("n",blk_num)("p",c->peer_name()));
+      c->enqueue( block_transactions_request_message{blk_id, missing} );
+      auto dropped = c->pending_compact_blocks.add( compact_block_message{std::move(block), std::move(missing)} );
+      if (dropped) {
+         // gave up on rebuilding the oldest one, instead of losing track of it
+         request_full_block(c, *dropped);
+      }
+   }
+
+   void net_plugin_impl::handle_message( connection_ptr c, const block_transactions_request_message &msg) {
+      peer_ilog(c, "received block_transactions_request_message : ${m} transactions", ("m",msg.indices.size()));
+      block_transactions_message reply;
+      reply.block_id = msg.block_id;
+      try {
+         signed_block_ptr b = chain_plug->chain().fetch_block_by_id(msg.block_id);
+         if (b) {
+            reply.trxs.reserve(msg.indices.size());
+            for (auto i : msg.indices) {
+               if (i >= b->transactions.size() || !b->transactions[i].trx.contains<packed_transaction>()) {
+                  reply.trxs.clear();
+                  break;
+               }
+               reply.trxs.push_back(b->transactions[i].trx.get<packed_transaction>());
+            }
+         }
+      } catch (const assert_exception &ex) {
+         elog( "caught assert on fetch_block_by_id, ${ex}, id ${id} for ${p}",
+               ("ex",ex.to_string())("id",msg.block_id)("p",c->peer_name()));
+      }
+      // an empty reply makes the peer fall back to requesting the full block
+      c->enqueue(reply);
+   }
+
+   void net_plugin_impl::handle_message( connection_ptr c, const block_transactions_message &msg) {
+      auto pending = c->pending_compact_blocks.take(msg.block_id);
+      if (!pending) {
+         fc_dlog(logger, "dropping transactions of block ${id} that is not pending from ${p}", ("id",msg.block_id)("p",c->peer_name()));
+         return;
+      }
+      if (!complete_compact_block(*pending, msg)) {
+         peer_wlog(c, "peer could not supply the transactions of block #${n}", ("n",pending->block.block_num()));
+         request_full_block(c, msg.block_id);
+         return;
+      }
+      accept_compact_block(c, pending->block);
+   }
+
+   void net_plugin_impl::handle_message( connection_ptr c, const compressed_block_message &msg) {
+      // normally already inflated by process_next_message on the network thread
+      handle_message( c, fc::raw::unpack<signed_block>( zlib_decompress( msg.data ) ) );
+   }
+
+   void net_plugin_impl::accept_compact_block( connection_ptr c, const signed_block& b ) {
+      // a transaction id does not cover the signatures, so the rebuilt block may still differ from the one that was produced
+      if( !matches_transaction_mroot( b ) ) {
+         peer_wlog(c, "rebuilt block #${n} does not match its transaction_mroot", ("n",b.block_num()));
+         request_full_block(c, b.id());
+         return;
+      }
+      handle_message(c, b);
+   }
+
+   void net_plugin_impl::request_full_block( connection_ptr c, const block_id_type& id ) {
+      request_message req;
+      req.req_blocks.mode = normal;
+      req.req_blocks.ids.push_back(id);
+      req.req_trx.mode = none;
+      c->enqueue(req);
+   }
+
    void net_plugin_impl::start_conn_timer(boost::asio::steady_timer::duration du, std::weak_ptr<connection> from_connection) {
       connector_check->expires_from_now( du);
       connector_check->async_wait( [this, from_connection](boost::system::error_code ec) {
@@ -2611,39 +2923,53 @@ namespace eosio {
                wlog ("Peer keepalive ticked sooner than expected: ${m}", ("m", ec.message()));
             }
             for (auto &c : connections ) {
-               if (c->socket->is_open()) {
+               if (c->socket_is_open()) {
                   c->send_time();
                }
             }
          });
    }
 
+   void net_plugin_impl::start_announce_timer() {
+      if( announce_pending || dispatcher->txn_announce_window.count() == 0 ) {
+         return;
+      }
+      announce_pending = true;
+      announce_timer->expires_from_now( std::chrono::microseconds( dispatcher->txn_announce_window.count() ));
+      announce_timer->async_wait( [this](boost::system::error_code ec) {
+            announce_pending = false;
+            if( ec ) {
+               return;
+            }
+            for( auto& c : connections ) {
+               c->send_trx_announce();
+            }
+         });
+   }
+
    void net_plugin_impl::start_monitors() {
       connector_check.reset(new boost::asio::steady_timer( app().get_io_service()));
       transaction_check.reset(new boost::asio::steady_timer( app().get_io_service()));
+      announce_timer.reset(new boost::asio::steady_timer( app().get_io_service()));
       start_conn_timer(connector_period, std::weak_ptr<connection>());
       start_txn_timer();
    }
 
    void net_plugin_impl::expire_txns() {
       start_txn_timer( );
-      auto &old = local_txns.get<by_expiry>();
-      auto ex_up = old.upper_bound( time_point::now());
-      auto ex_lo = old.lower_bound( fc::time_point_sec( 0));
-      old.erase( ex_lo, ex_up);
+      auto now = time_point_sec(time_point::now());
+      local_txns.erase_expired( now );
 
-      auto &stale = local_txns.get<by_block_num>();
       controller &cc = chain_plug->chain();
       uint32_t bn = cc.last_irreversible_block_num();
-      stale.erase( stale.lower_bound(1), stale.upper_bound(bn) );
+      local_txns.erase_included( bn );
+      auto &relayed = dispatcher->relayed_blocks;
+      relayed.erase( relayed.begin(), relayed.upper_bound(bn) );
       for ( auto &c : connections ) {
-         auto &stale_txn = c->trx_state.get<by_block_num>();
-         stale_txn.erase( stale_txn.lower_bound(1), stale_txn.upper_bound(bn) );
-         auto &stale_txn_e = c->trx_state.get<by_expiry>();
-         stale_txn_e.erase(stale_txn_e.lower_bound(time_point_sec()), stale_txn_e.upper_bound(time_point::now()));
          auto &stale_blk = c->blk_state.get<by_block_num>();
          stale_blk.erase( stale_blk.lower_bound(1), stale_blk.upper_bound(bn) );
       }
+      dispatcher->req_trx.erase_expired( now );
    }
 
    void net_plugin_impl::connection_monitor(std::weak_ptr<connection> from_connection) {
@@ -2657,7 +2983,7 @@ namespace eosio {
             start_conn_timer(std::chrono::milliseconds(1), *it); // avoid exhausting
             return;
          }
-         if( !(*it)->socket->is_open() && !(*it)->connecting) {
+         if( !(*it)->socket_is_open() && !(*it)->connecting) {
             if( (*it)->peer_addr.length() > 0) {
                connect(*it);
             }
@@ -2672,7 +2998,7 @@ namespace eosio {
    }
 
    void net_plugin_impl::close( connection_ptr c ) {
-      if( c->peer_addr.empty( ) && c->socket->is_open() ) {
+      if( c->peer_addr.empty( ) && c->socket_is_open() ) {
          if (num_clients == 0) {
             fc_wlog( logger, "num_clients already at 0");
          }
@@ -2683,6 +3009,16 @@ namespace eosio {
       c->close();
    }
 
+   void net_plugin_impl::close_on_app_thread( const connection_ptr& c, const string& reason ) {
+      connection_wptr weak_conn = c;
+      app().get_io_service().post( [this, weak_conn, reason]() {
+         auto c = weak_conn.lock();
+         if( !c ) return;
+         elog( "${r}, closing connection to ${p}", ("r", reason)("p", c->peer_name()) );
+         close( c );
+      });
+   }
+
    void net_plugin_impl::accepted_block_header(const block_state_ptr& block) {
       fc_dlog(logger,"signaled, id = ${id}",("id", block->id));
    }
@@ -2874,8 +3210,23 @@ namespace eosio {
          ( "network-version-match", bpo::value<bool>()->default_value(false),
            "True to require exact match of peer network version.")
          ( "sync-fetch-span", bpo::value<uint32_t>()->default_value(def_sync_fetch_span), "number of blocks to retrieve in a chunk from any individual peer during synchronization")
+         ( "sync-fetch-peers", bpo::value<uint32_t>()->default_value(def_sync_fetch_peers), "maximum number of peers blocks are retrieved from at the same time during synchronization")
          ( "max-implicit-request", bpo::value<uint32_t>()->default_value(def_max_just_send), "maximum sizes of transaction or block messages that are sent without first sending a notice")
+         ( "txn-announce-window-ms", bpo::value<uint32_t>()->default_value(def_txn_announce_window_ms),
+           "Milliseconds transaction ids are collected before they are announced to peers, which then request the transactions they do not have. 0 relays whole transactions.")
+         ( "txn-announce-max-ids", bpo::value<uint32_t>()->default_value(def_txn_announce_max_ids),
+           "Maximum number of transaction ids announced to a peer in one message, a full batch is sent before the window is over")
          ( "use-socket-read-watermark", bpo::value<bool>()->default_value(false), "Enable expirimental socket read watermark optimization")
+         ( "net-threads", bpo::value<uint16_t>()->default_value(my->thread_pool_size),
+           "Number of worker threads for peer socket I/O and message decoding")
+         ( "compact-block-relay", bpo::value<bool>()->default_value(true),
+           "Relay blocks to peers that support it with the transactions already relayed to them replaced by their ids")
+         ( "header-validated-relay", bpo::value<bool>()->default_value(false),
+           "Relay blocks received at head as soon as their header and producer signature validate, before they are applied. A block that then fails to apply has already reached peers, which reject it on their own.")
+         ( "sync-compression", bpo::value<bool>()->default_value(false),
+           "Compress blocks sent to peers syncing from this node, for peers that support it. Blocks relayed at head are never compressed.")
+         ( "sync-compression-min-size", bpo::value<uint32_t>()->default_value(def_sync_compression_min_size),
+           "Minimum size in bytes of a block for it to be compressed when sync-compression is enabled")
          ( "peer-log-format", bpo::value<string>()->default_value( "[\"${_name}\" ${_ip}:${_port}]" ),
            "The string used to format peers when logging messages about them.  Variables are escaped with ${<variable name>}.\n"
            "Available Variables:\n"
@@ -2901,7 +3252,10 @@ namespace eosio {
 
          my->network_version_match = options.at( "network-version-match" ).as<bool>();
 
-         my->sync_master.reset( new sync_manager( options.at( "sync-fetch-span" ).as<uint32_t>()));
+         EOS_ASSERT( options.at( "sync-fetch-peers" ).as<uint32_t>() > 0, chain::plugin_config_exception,
+                     "sync-fetch-peers must be greater than 0" );
+         my->sync_master.reset( new sync_manager( options.at( "sync-fetch-span" ).as<uint32_t>(),
+                                                  options.at( "sync-fetch-peers" ).as<uint32_t>()));
          my->dispatcher.reset( new dispatch_manager );
 
          my->connector_period = std::chrono::seconds( options.at( "connection-cleanup-period" ).as<int>());
@@ -2909,12 +3263,25 @@ namespace eosio {
          my->txn_exp_period = def_txn_expire_wait;
          my->resp_expected_period = def_resp_expected_wait;
          my->dispatcher->just_send_it_max = options.at( "max-implicit-request" ).as<uint32_t>();
+         my->dispatcher->txn_announce_window = fc::milliseconds( options.at( "txn-announce-window-ms" ).as<uint32_t>());
+         my->dispatcher->txn_announce_max_ids = options.at( "txn-announce-max-ids" ).as<uint32_t>();
+         EOS_ASSERT( my->dispatcher->txn_announce_max_ids > 0, chain::plugin_config_exception,
+                     "txn-announce-max-ids must be greater than 0" );
          my->max_client_count = options.at( "max-clients" ).as<int>();
          my->max_nodes_per_host = options.at( "p2p-max-nodes-per-host" ).as<int>();
          my->num_clients = 0;
          my->started_sessions = 0;
 
          my->use_socket_read_watermark = options.at( "use-socket-read-watermark" ).as<bool>();
+         my->compact_block_relay = options.at( "compact-block-relay" ).as<bool>();
+         my->header_validated_relay = options.at( "header-validated-relay" ).as<bool>();
+         my->sync_compression = options.at( "sync-compression" ).as<bool>();
+         my->sync_compression_min_size = options.at( "sync-compression-min-size" ).as<uint32_t>();
+
+         my->thread_pool_size = options.at( "net-threads" ).as<uint16_t>();
+         EOS_ASSERT( my->thread_pool_size > 0, chain::plugin_config_exception,
+                     "net-threads ${num} must be greater than 0", ("num", my->thread_pool_size) );
+         my->thread_pool_ios.reset( new boost::asio::io_service() );
 
          my->resolver = std::make_shared<tcp::resolver>( std::ref( app().get_io_service()));
          if( options.count( "p2p-listen-endpoint" )) {
@@ -3000,6 +3367,13 @@ namespace eosio {
    }
 
    void net_plugin::plugin_startup() {
+      my->thread_pool_work.emplace( *my->thread_pool_ios );
+      for( uint16_t i = 0; i < my->thread_pool_size; ++i ) {
+         my->thread_pool.emplace_back( [ios = my->thread_pool_ios.get()]() {
+            ios->run();
+         });
+      }
+
       if( my->acceptor ) {
          my->acceptor->open(my->listen_endpoint.protocol());
          my->acceptor->set_option(tcp::acceptor::reuse_address(true));
@@ -3048,15 +3422,25 @@ namespace eosio {
          if( my->acceptor ) {
             ilog( "close acceptor" );
             my->acceptor->close();
+            my->acceptor.reset(nullptr);
+         }
 
-            ilog( "close ${s} connections",( "s",my->connections.size()) );
-            auto cons = my->connections;
-            for( auto con : cons ) {
-               my->close( con);
-            }
+         ilog( "close ${s} connections",( "s",my->connections.size()) );
+         auto cons = my->connections;
+         for( auto con : cons ) {
+            my->close( con);
+         }
 
-            my->acceptor.reset(nullptr);
+         my->thread_pool_work.reset();
+         if( my->thread_pool_ios ) {
+            my->thread_pool_ios->stop();
+         }
+         for( auto& t : my->thread_pool ) {
+            t.join();
          }
+         my->thread_pool.clear();
+         // no network thread can reach a connection any more
+         my->connections.clear();
          ilog( "exit shutdown" );
       }
       FC_CAPTURE_AND_RETHROW()
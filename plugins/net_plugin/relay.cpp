@@ -0,0 +1,169 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/net_plugin/relay.hpp>
+#include <eosio/chain/controller.hpp>
+#include <eosio/chain/exceptions.hpp>
+#include <eosio/chain/merkle.hpp>
+
+#include <fc/io/raw.hpp>
+
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+
+namespace eosio {
+
+   namespace bio = boost::iostreams;
+
+   /// stops inflating a compressed message that grows beyond what a peer may send uncompressed
+   struct decompression_limiter {
+      using char_type = char;
+      using category = bio::multichar_output_filter_tag;
+
+      template<typename Sink>
+      size_t write(Sink &sink, const char* s, size_t count)
+      {
+         EOS_ASSERT(_total + count <= max_inflated_message_size, plugin_exception, "Exceeded maximum decompressed message size");
+         _total += count;
+         return bio::write(sink, s, count);
+      }
+
+      size_t _total = 0;
+   };
+
+   bytes zlib_compress( const bytes& data ) {
+      bytes out;
+      bio::filtering_ostream comp;
+      comp.push(bio::zlib_compressor(bio::zlib::default_compression));
+      comp.push(bio::back_inserter(out));
+      bio::write(comp, data.data(), data.size());
+      bio::close(comp);
+      return out;
+   }
+
+   bytes zlib_decompress( const bytes& data ) {
+      try {
+         bytes out;
+         bio::filtering_ostream decomp;
+         decomp.push(bio::zlib_decompressor());
+         decomp.push(decompression_limiter());
+         decomp.push(bio::back_inserter(out));
+         bio::write(decomp, data.data(), data.size());
+         bio::close(decomp);
+         return out;
+      } catch( const fc::exception& ) {
+         throw;
+      } catch( const std::exception& e ) {
+         EOS_THROW( plugin_exception, "unable to decompress message: ${e}", ("e", e.what()) );
+      }
+   }
+
+   std::shared_ptr<vector<char>> create_send_buffer( const net_message& m ) {
+      uint32_t payload_size = fc::raw::pack_size( m );
+      char * header = reinterpret_cast<char*>(&payload_size);
+      size_t header_size = sizeof(payload_size);
+
+      size_t buffer_size = header_size + payload_size;
+
+      auto send_buffer = send_buffer_pool::instance().get(buffer_size);
+      fc::datastream<char*> ds( send_buffer->data(), buffer_size);
+      ds.write( header, header_size );
+      fc::raw::pack( ds, m );
+      return send_buffer;
+   }
+
+   std::shared_ptr<vector<char>> create_sync_block_buffer( const signed_block& b, uint32_t min_size ) {
+      auto packed = fc::raw::pack( b );
+      if( packed.size() >= min_size ) {
+         return create_send_buffer( compressed_block_message{ zlib_compress( packed ) } );
+      }
+      return create_send_buffer( b );
+   }
+
+   void inflate_message( net_message& msg ) {
+      if( msg.contains<compressed_block_message>() ) {
+         auto packed = zlib_decompress( msg.get<compressed_block_message>().data );
+         msg = fc::raw::unpack<signed_block>( packed );
+      }
+   }
+
+   send_priority priority_of( const net_message& m ) {
+      if (m.contains<signed_block>() || m.contains<compact_block_message>() || m.contains<block_transactions_message>()) {
+         return block_priority;
+      }
+      if (m.contains<packed_transaction>()) {
+         return transaction_priority;
+      }
+      if (m.contains<compressed_block_message>()) {
+         return sync_priority;
+      }
+      return control_priority;
+   }
+
+   bool matches_transaction_mroot( const signed_block& b ) {
+      vector<digest_type> trx_digests;
+      trx_digests.reserve( b.transactions.size() );
+      for( const auto& r : b.transactions )
+         trx_digests.emplace_back( r.digest() );
+      return merkle( std::move(trx_digests) ) == b.transaction_mroot;
+   }
+
+   bool relayable_header( const controller& cc, const signed_block& b ) {
+      auto prev = cc.fetch_block_state_by_id( b.previous );
+      if( !prev ) {
+         // not linkable yet, relayed as usual once applied
+         return false;
+      }
+      prev->next( b );
+      // the producer signature does not cover the transactions themselves
+      return matches_transaction_mroot( b );
+   }
+
+   compact_block_message make_compact_block( const signed_block& b, const node_transaction_index& local_txns ) {
+      compact_block_message cb;
+      cb.block = b;
+      for (uint32_t i = 0; i < cb.block.transactions.size(); ++i) {
+         auto& receipt = cb.block.transactions[i];
+         if (!receipt.trx.contains<packed_transaction>()) {
+            continue;
+         }
+         // transactions that went through our relay have most likely reached our peers too
+         auto id = receipt.trx.get<packed_transaction>().id();
+         if (local_txns.find(id)) {
+            receipt.trx = id;
+            cb.compacted.push_back(i);
+         }
+      }
+      return cb;
+   }
+
+   bool fill_compact_block( signed_block& b, const vector<uint32_t>& compacted, const node_transaction_index& local_txns,
+                            vector<uint32_t>& missing ) {
+      for (auto i : compacted) {
+         if (i >= b.transactions.size() || !b.transactions[i].trx.contains<transaction_id_type>()) {
+            return false;
+         }
+         auto& receipt = b.transactions[i];
+         auto ltx = local_txns.find(receipt.trx.get<transaction_id_type>());
+         if (ltx) {
+            receipt.trx = ltx->packed_txn;
+         } else {
+            missing.push_back(i);
+         }
+      }
+      return true;
+   }
+
+   bool complete_compact_block( compact_block_message& pending, const block_transactions_message& msg ) {
+      if (msg.trxs.size() != pending.compacted.size()) {
+         return false;
+      }
+      for (size_t i = 0; i < msg.trxs.size(); ++i) {
+         pending.block.transactions[pending.compacted[i]].trx = msg.trxs[i];
+      }
+      return true;
+   }
+
+} // namespace eosio
@@ -7,6 +7,7 @@
 
 #include <eosio/chain_plugin/chain_plugin.hpp>
 #include <eosio/http_client_plugin/http_client_plugin.hpp>
+#include <eosio/producer_plugin/transaction_queue.hpp>
 
 #include <appbase/application.hpp>
 
@@ -65,6 +66,8 @@ public:
    void remove_greylist_accounts(const greylist_params& params);
    greylist_params get_greylist() const;
 
+   transaction_queue_metrics get_incoming_transaction_queue() const;
+
    whitelist_blacklist get_whitelist_blacklist() const;
    void set_whitelist_blacklist(const whitelist_blacklist& params);
    
@@ -0,0 +1,103 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/chain/types.hpp>
+#include <eosio/chain/config.hpp>
+#include <eosio/chain/block_timestamp.hpp>
+#include <eosio/chain/controller.hpp>
+#include <eosio/chain/resource_limits.hpp>
+#include <eosio/chain/resource_limits_private.hpp>
+
+#include <fc/time.hpp>
+
+#include <map>
+#include <algorithm>
+
+namespace eosio {
+
+   using chain::account_name;
+
+   /**
+    *  Ledger of CPU time spent by this node on transactions that failed and were therefore never billed
+    *  on chain. The time is charged to the first authorizer of the failed transaction and decays with
+    *  the same exponential moving average, over the same window, as the objective CPU usage kept by
+    *  resource_limits, so it can be compared directly against an account's available CPU.
+    *
+    *  The ledger is local to this node and never affects consensus; it is only used to decide which
+    *  transactions this node is willing to spend time on.
+    */
+   class subjective_billing {
+      public:
+         static constexpr uint32_t default_window_size = chain::config::account_cpu_usage_average_window_ms / chain::config::block_interval_ms;
+
+         explicit subjective_billing( uint32_t window_size = default_window_size )
+         :_window_size(window_size) {}
+
+         bool is_disabled()const { return _disabled; }
+         void disable() { _disabled = true; }
+
+         /// Charge elapsed time of a failed transaction to its first authorizer
+         void bill( const account_name& first_authorizer, fc::microseconds elapsed, fc::time_point now ) {
+            if( _disabled || elapsed.count() <= 0 || first_authorizer == account_name() ) return;
+            auto& usage = _usage[first_authorizer];
+            usage.add( uint64_t(elapsed.count()), std::max( time_ordinal(now), usage.last_ordinal ), _window_size );
+         }
+
+         /// Like bill, but only if first_authorizer exists on chain, so the ledger cannot be filled with made up names
+         void bill( const chain::controller& chain, const account_name& first_authorizer, fc::microseconds elapsed, fc::time_point now ) {
+            if( account_exists( chain, first_authorizer ) )
+               bill( first_authorizer, elapsed, now );
+         }
+
+         /// Decayed CPU time (in microseconds) billed to account within the window
+         int64_t get_subjective_bill( const account_name& account, fc::time_point now )const {
+            if( _disabled ) return 0;
+            auto itr = _usage.find( account );
+            if( itr == _usage.end() ) return 0;
+
+            auto usage = itr->second;
+            usage.add( 0, std::max( time_ordinal(now), usage.last_ordinal ), _window_size );
+            return int64_t( ((chain::uint128_t)usage.value_ex * _window_size) / chain::config::rate_limiting_precision );
+         }
+
+         /// True if the CPU billed to account exceeds the CPU it has available on chain
+         bool exceeds_available_cpu( const chain::controller& chain, const account_name& account, fc::time_point now )const {
+            auto bill = get_subjective_bill( account, now );
+            if( bill <= 0 ) return false;
+            // an account that does not exist has no CPU at all
+            if( !account_exists( chain, account ) ) return true;
+            auto available = chain.get_resource_limits_manager().get_account_cpu_limit( account );
+            return available >= 0 && bill >= available;
+         }
+
+         /// Forget accounts whose bill has fully decayed
+         void remove_expired( fc::time_point now ) {
+            auto ordinal = time_ordinal( now );
+            for( auto itr = _usage.begin(); itr != _usage.end(); ) {
+               if( uint64_t(itr->second.last_ordinal) + _window_size <= ordinal )
+                  itr = _usage.erase( itr );
+               else
+                  ++itr;
+            }
+         }
+
+         size_t size()const { return _usage.size(); }
+
+      private:
+         static bool account_exists( const chain::controller& chain, const account_name& account ) {
+            return chain.db().find<chain::resource_limits::resource_usage_object, chain::resource_limits::by_owner>( account ) != nullptr;
+         }
+
+         static uint32_t time_ordinal( fc::time_point t ) {
+            return chain::block_timestamp_type( t ).slot;
+         }
+
+         uint32_t                                                   _window_size;
+         bool                                                       _disabled = false;
+         std::map<account_name, chain::resource_limits::usage_accumulator> _usage;
+   };
+
+} // eosio
@@ -0,0 +1,185 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/chain/controller.hpp>
+#include <eosio/chain/exceptions.hpp>
+#include <eosio/chain/transaction_metadata.hpp>
+#include <eosio/chain/block_summary_object.hpp>
+#include <eosio/chain/global_property_object.hpp>
+#include <eosio/chain/contract_types.hpp>
+
+#include <fc/time.hpp>
+
+#include <vector>
+#include <algorithm>
+
+namespace eosio {
+
+   using chain::transaction_metadata;
+
+   /**
+    *  Immutable copy of the chain state needed to validate incoming transactions without the controller.
+    *
+    *  A snapshot is taken on the main thread whenever a block is accepted, and handed to the admission
+    *  threads by shared pointer. It may be slightly behind the controller, so every check made against it
+    *  only rejects transactions that the controller would also reject from then on; anything the snapshot
+    *  cannot decide is let through to the controller. In particular TaPoS is only checked against blocks that
+    *  are irreversible in the snapshot, which no fork switch can replace.
+    */
+   struct admission_snapshot {
+      static constexpr uint32_t tapos_window = 1024; ///< irreversible blocks TaPoS is checked against
+
+      typedef flat_set<chain::public_key_type> key_set;
+
+      chain::chain_id_type                chain_id;
+      uint32_t                            head_block_num = 0;
+      fc::time_point                      earliest_block_time; ///< no later block can have an earlier timestamp
+      chain::chain_config                 configuration;
+      std::shared_ptr<const key_set>      key_blacklist;       ///< copied when the controller's changes
+      uint32_t                            first_tapos_block_num = 0;
+      std::vector<uint32_t>               tapos_prefixes;      ///< of the last irreversible blocks, from first_tapos_block_num; 0 if unknown
+
+      /// Snapshot of the controller's current state, also taken after the key blacklist changes
+      static std::shared_ptr<const admission_snapshot> create( const chain::controller& chain ) {
+         auto s = std::make_shared<admission_snapshot>();
+         s->key_blacklist = std::make_shared<const key_set>( chain.get_key_blacklist() );
+         s->update( chain, chain.head_block_state() );
+         return s;
+      }
+
+      /// Copy of this snapshot advanced to block bsp
+      std::shared_ptr<const admission_snapshot> next( const chain::controller& chain, const chain::block_state_ptr& bsp )const {
+         auto s = std::make_shared<admission_snapshot>( *this );
+         s->update( chain, bsp );
+         return s;
+      }
+
+      /// ref_block_prefix of the irreversible block whose number ends in ref_block_num, 0 if the snapshot does not hold one
+      uint32_t irreversible_prefix( uint16_t ref_block_num )const {
+         uint32_t num = first_tapos_block_num + uint16_t( ref_block_num - uint16_t( first_tapos_block_num ) );
+         // the controller's block summary for ref_block_num keeps naming that block for 0x10000 blocks, far past
+         // the lifetime of any transaction; half of that is left as margin
+         if( num - first_tapos_block_num >= tapos_prefixes.size() || head_block_num - num >= 0x8000 ) {
+            return 0;
+         }
+         return tapos_prefixes[num - first_tapos_block_num];
+      }
+
+      private:
+         void update( const chain::controller& chain, const chain::block_state_ptr& bsp ) {
+            chain_id            = chain.get_chain_id();
+            head_block_num      = bsp->block_num;
+            earliest_block_time = bsp->header.timestamp.next().to_time_point();
+            configuration       = chain.get_global_properties().configuration;
+            update_tapos( chain );
+         }
+
+         /// appends the blocks that became irreversible, read from the controller's block summaries
+         void update_tapos( const chain::controller& chain ) {
+            uint32_t lib = chain.last_irreversible_block_num();
+            uint32_t first = lib > tapos_window ? lib - tapos_window + 1 : 1;
+            uint32_t next_num = first_tapos_block_num + tapos_prefixes.size();
+            if( tapos_prefixes.empty() || next_num < first ) {
+               tapos_prefixes.clear();
+               next_num = first;
+            } else if( first > first_tapos_block_num ) {
+               tapos_prefixes.erase( tapos_prefixes.begin(), tapos_prefixes.begin() + (first - first_tapos_block_num) );
+            } else {
+               first = first_tapos_block_num;
+            }
+            first_tapos_block_num = first;
+            for( uint32_t num = next_num; num <= lib; ++num ) {
+               const auto& summary = chain.db().get<chain::block_summary_object>( uint16_t(num) );
+               bool known = chain::block_header::num_from_id( summary.block_id ) == num;
+               tapos_prefixes.push_back( known ? uint32_t( summary.block_id._hash[1] ) : 0 );
+            }
+         }
+   };
+
+   /**
+    *  Keys that the newaccount and updateauth actions of trx put into authorities. These are what the controller
+    *  checks against the key blacklist. Actions whose data does not unpack are left to the controller.
+    */
+   inline std::vector<chain::public_key_type> authority_keys( const chain::transaction& trx ) {
+      using namespace chain;
+      std::vector<public_key_type> keys;
+      auto add = [&]( const authority& auth ) {
+         for( const auto& k : auth.keys ) {
+            keys.push_back( k.key );
+         }
+      };
+      for( const auto& act : trx.actions ) {
+         if( act.account != config::system_account_name ) {
+            continue;
+         }
+         try {
+            if( act.name == newaccount::get_name() ) {
+               auto na = act.data_as<newaccount>();
+               add( na.owner );
+               add( na.active );
+            } else if( act.name == updateauth::get_name() ) {
+               add( act.data_as<updateauth>().auth );
+            }
+         } catch( const fc::exception& ) {
+            // the controller reports the malformed action
+         }
+      }
+      return keys;
+   }
+
+   /**
+    *  Context free validation of an incoming transaction: size limits, expiration, TaPoS against irreversible
+    *  blocks, the key blacklist, and signature recovery. Recovered keys are cached in trx for the controller
+    *  to reuse.
+    *  Safe to call from any thread; throws the exception the controller would fail the transaction with.
+    */
+   inline void validate_for_admission( const admission_snapshot& s, transaction_metadata& mtrx ) {
+      using namespace chain;
+      const auto& trx = mtrx.trx;
+      const auto& cfg = s.configuration;
+
+      EOS_ASSERT( time_point(trx.expiration) >= s.earliest_block_time, expired_tx_exception,
+                  "expired transaction ${id}", ("id", mtrx.id) );
+      // the pending block can be at most one block interval ahead of the wall clock
+      auto latest_block_time = std::max( fc::time_point::now(), s.earliest_block_time ) + fc::microseconds( config::block_interval_us );
+      EOS_ASSERT( time_point(trx.expiration) <= latest_block_time + fc::seconds(cfg.max_transaction_lifetime), tx_exp_too_far_exception,
+                  "Transaction expiration is too far in the future, expiration is ${exp} and the maximum transaction lifetime is ${max} seconds",
+                  ("exp", trx.expiration)("max", cfg.max_transaction_lifetime) );
+
+      // same initial net usage as transaction_context::init_for_input_trx
+      uint64_t discounted_prunable_size = mtrx.packed_trx.get_prunable_size();
+      if( cfg.context_free_discount_net_usage_den > 0 && cfg.context_free_discount_net_usage_num < cfg.context_free_discount_net_usage_den ) {
+         discounted_prunable_size *= cfg.context_free_discount_net_usage_num;
+         discounted_prunable_size = ( discounted_prunable_size + cfg.context_free_discount_net_usage_den - 1 ) / cfg.context_free_discount_net_usage_den;
+      }
+      uint64_t net_usage = uint64_t(cfg.base_per_transaction_net_usage) + mtrx.packed_trx.get_unprunable_size() + discounted_prunable_size;
+      if( trx.delay_sec.value > 0 ) {
+         net_usage += uint64_t(cfg.base_per_transaction_net_usage) + uint64_t(config::transaction_id_net_usage);
+      }
+      uint64_t net_limit = cfg.max_transaction_net_usage;
+      if( trx.max_net_usage_words.value > 0 ) {
+         net_limit = std::min( net_limit, uint64_t(trx.max_net_usage_words.value) * 8 );
+      }
+      EOS_ASSERT( net_usage <= net_limit, tx_net_usage_exceeded,
+                  "net usage of transaction is too high: ${net_usage} > ${net_limit}", ("net_usage", net_usage)("net_limit", net_limit) );
+
+      auto prefix = s.irreversible_prefix( trx.ref_block_num );
+      EOS_ASSERT( prefix == 0 || prefix == trx.ref_block_prefix, invalid_ref_block_exception,
+                  "Transaction's reference block did not match. Is this transaction from a different fork?" );
+
+      // the controller checks the keys when the actions run, which a delayed transaction's do not on admission
+      if( trx.delay_sec.value == 0 && s.key_blacklist && !s.key_blacklist->empty() ) {
+         for( const auto& key : authority_keys( trx ) ) {
+            EOS_ASSERT( s.key_blacklist->find( key ) == s.key_blacklist->end(), key_blacklist_exception,
+                        "public key '${key}' is on the key blacklist", ("key", key) );
+         }
+      }
+
+      // recovered here so the controller finds the keys cached
+      mtrx.recover_keys( s.chain_id );
+   }
+
+} // eosio
@@ -0,0 +1,224 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/chain/types.hpp>
+#include <eosio/chain/exceptions.hpp>
+
+#include <fc/time.hpp>
+#include <fc/reflect/reflect.hpp>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <tuple>
+#include <functional>
+#include <algorithm>
+
+namespace eosio {
+
+   using chain::account_name;
+
+   /**
+    *  Order in which a producer applies the transactions it has queued
+    */
+   enum class transaction_queue_policy {
+      fifo,            ///< arrival order
+      account_fair,    ///< round robin across first authorizers
+      cpu_weighted,    ///< each first authorizer gets a share proportional to its CPU weight
+      earliest_expiry  ///< transactions closest to their expiration first
+   };
+
+   inline const char* to_string( transaction_queue_policy p ) {
+      switch( p ) {
+         case transaction_queue_policy::fifo:            return "fifo";
+         case transaction_queue_policy::account_fair:    return "account-fair";
+         case transaction_queue_policy::cpu_weighted:    return "cpu-weighted";
+         case transaction_queue_policy::earliest_expiry: return "earliest-expiry";
+      }
+      return "unknown";
+   }
+
+   inline transaction_queue_policy transaction_queue_policy_from_string( const std::string& s ) {
+      for( auto p : { transaction_queue_policy::fifo, transaction_queue_policy::account_fair,
+                      transaction_queue_policy::cpu_weighted, transaction_queue_policy::earliest_expiry } ) {
+         if( s == to_string(p) ) return p;
+      }
+      EOS_THROW( chain::plugin_config_exception, "unknown transaction queue policy \"${p}\"", ("p", s) );
+   }
+
+   struct account_queue_metrics {
+      account_name account;
+      uint32_t     queued = 0;
+      uint64_t     enqueued = 0;   ///< since the account's queue was last empty
+      uint64_t     dispatched = 0; ///< since the account's queue was last empty
+   };
+
+   struct transaction_queue_metrics {
+      std::string                    policy;
+      uint32_t                       queued = 0;
+      uint32_t                       peak_queued = 0;
+      uint64_t                       enqueued = 0;
+      uint64_t                       dispatched = 0;
+      std::vector<account_queue_metrics> accounts; ///< deepest per account queues, account based policies only
+   };
+
+   /**
+    *  Queue of pending transactions that hands them out according to a transaction_queue_policy.
+    *
+    *  The account based policies use stride scheduling: every first authorizer with queued transactions
+    *  has a virtual pass value which advances by max_weight / weight each time one of its transactions is
+    *  handed out, and the account with the lowest pass goes next. Ties are broken in activation order, which
+    *  makes equal weights a plain round robin. An account that becomes active starts at the pass of the
+    *  last dispatch, so it cannot bank credit while idle.
+    *
+    *  Weights are clamped to [1, max_weight] and passes are integers, so no weight makes the pass stop
+    *  advancing; weight providers should scale weights into that range.
+    */
+   template<typename T>
+   class transaction_queue {
+      public:
+         using weight_provider = std::function<int64_t(const account_name&)>;
+
+         static constexpr uint32_t max_reported_accounts = 32;
+         static constexpr int64_t  max_weight = int64_t(1) << 20;
+
+         explicit transaction_queue( transaction_queue_policy p = transaction_queue_policy::fifo, weight_provider w = weight_provider() )
+         :_policy(p),_weight(std::move(w)) {}
+
+         transaction_queue_policy policy()const { return _policy; }
+
+         /// True if push_back needs the real first authorizer of each transaction
+         bool orders_by_account()const {
+            return _policy == transaction_queue_policy::account_fair || _policy == transaction_queue_policy::cpu_weighted;
+         }
+
+         bool   empty()const { return _size == 0; }
+         size_t size()const  { return _size; }
+
+         void push_back( T&& v, const account_name& first_authorizer, fc::time_point expiration ) {
+            switch( _policy ) {
+               case transaction_queue_policy::fifo:
+                  _fifo.emplace_back( std::move(v) );
+                  break;
+               case transaction_queue_policy::earliest_expiry:
+                  _by_expiry.emplace( expiration, std::move(v) );
+                  break;
+               default: {
+                  auto& q = _accounts[first_authorizer];
+                  if( q.entries.empty() ) {
+                     q.pass = std::max( q.pass, _virtual_time );
+                     _ready.emplace( q.pass, _activations++, first_authorizer );
+                  }
+                  q.entries.emplace_back( std::move(v) );
+                  ++q.enqueued;
+               }
+            }
+
+            ++_size;
+            ++_enqueued;
+            _peak_size = std::max( _peak_size, _size );
+         }
+
+         T pop_front() {
+            EOS_ASSERT( _size > 0, chain::producer_exception, "pop_front on an empty transaction queue" );
+
+            T result;
+            switch( _policy ) {
+               case transaction_queue_policy::fifo:
+                  result = std::move( _fifo.front() );
+                  _fifo.pop_front();
+                  break;
+               case transaction_queue_policy::earliest_expiry:
+                  result = std::move( _by_expiry.begin()->second );
+                  _by_expiry.erase( _by_expiry.begin() );
+                  break;
+               default: {
+                  auto next = _ready.begin();
+                  auto account = std::get<2>( *next );
+                  _virtual_time = std::get<0>( *next );
+                  _ready.erase( next );
+
+                  auto qitr = _accounts.find( account );
+                  auto& q = qitr->second;
+                  result = std::move( q.entries.front() );
+                  q.entries.pop_front();
+                  ++q.dispatched;
+
+                  if( q.entries.empty() ) {
+                     _accounts.erase( qitr );
+                  } else {
+                     q.pass += uint64_t( max_weight / weight_of( account ) );
+                     _ready.emplace( q.pass, _activations++, account );
+                  }
+               }
+            }
+
+            --_size;
+            ++_dispatched;
+            if( _size == 0 ) {
+               // every account left, so passes can start over
+               _virtual_time = 0;
+            }
+            return result;
+         }
+
+         transaction_queue_metrics get_metrics()const {
+            transaction_queue_metrics m;
+            m.policy      = to_string( _policy );
+            m.queued      = _size;
+            m.peak_queued = _peak_size;
+            m.enqueued    = _enqueued;
+            m.dispatched  = _dispatched;
+
+            m.accounts.reserve( std::min( _accounts.size(), size_t(max_reported_accounts) ) );
+            for( const auto& a : _accounts ) {
+               m.accounts.push_back( account_queue_metrics{ a.first, uint32_t(a.second.entries.size()), a.second.enqueued, a.second.dispatched } );
+            }
+            auto deeper = []( const account_queue_metrics& l, const account_queue_metrics& r ) { return l.queued > r.queued; };
+            if( m.accounts.size() > max_reported_accounts ) {
+               std::partial_sort( m.accounts.begin(), m.accounts.begin() + max_reported_accounts, m.accounts.end(), deeper );
+               m.accounts.resize( max_reported_accounts );
+            } else {
+               std::sort( m.accounts.begin(), m.accounts.end(), deeper );
+            }
+            return m;
+         }
+
+      private:
+         struct account_queue {
+            std::deque<T> entries;
+            uint64_t      pass = 0;
+            uint64_t      enqueued = 0;
+            uint64_t      dispatched = 0;
+         };
+
+         int64_t weight_of( const account_name& account )const {
+            if( _policy != transaction_queue_policy::cpu_weighted || !_weight )
+               return 1;
+            // accounts without stake (or unlimited ones, reported as -1) get the smallest share
+            return std::min( std::max<int64_t>( _weight( account ), 1 ), max_weight );
+         }
+
+         transaction_queue_policy                           _policy;
+         weight_provider                                    _weight;
+
+         std::deque<T>                                      _fifo;
+         std::multimap<fc::time_point, T>                   _by_expiry;
+         std::map<account_name, account_queue>              _accounts;
+         std::set<std::tuple<uint64_t, uint64_t, account_name>> _ready; ///< (pass, activation, account)
+         uint64_t                                           _virtual_time = 0;
+         uint64_t                                           _activations = 0;
+
+         size_t                                             _size = 0;
+         size_t                                             _peak_size = 0;
+         uint64_t                                           _enqueued = 0;
+         uint64_t                                           _dispatched = 0;
+   };
+
+} // eosio
+
+FC_REFLECT(eosio::account_queue_metrics, (account)(queued)(enqueued)(dispatched))
+FC_REFLECT(eosio::transaction_queue_metrics, (policy)(queued)(peak_queued)(enqueued)(dispatched)(accounts))
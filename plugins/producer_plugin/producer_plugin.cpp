@@ -3,10 +3,14 @@
  *  @copyright defined in eos/LICENSE.txt
  */
 #include <eosio/producer_plugin/producer_plugin.hpp>
+#include <eosio/producer_plugin/subjective_billing.hpp>
+#include <eosio/producer_plugin/transaction_admission.hpp>
 #include <eosio/chain/producer_object.hpp>
 #include <eosio/chain/plugin_interface.hpp>
 #include <eosio/chain/global_property_object.hpp>
 #include <eosio/chain/transaction_object.hpp>
+#include <eosio/chain/resource_limits_private.hpp>
+#include <eosio/chain/unapplied_transaction_queue.hpp>
 
 #include <fc/io/json.hpp>
 #include <fc/smart_ref_impl.hpp>
@@ -17,6 +21,8 @@
 
 #include <iostream>
 #include <algorithm>
+#include <future>
+#include <thread>
 #include <boost/range/adaptor/map.hpp>
 #include <boost/function_output_iterator.hpp>
 #include <boost/multi_index_container.hpp>
@@ -115,6 +121,9 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
       void schedule_production_loop();
       void produce_block();
       bool maybe_produce_block();
+      bool complete_block_signature();
+      void log_produced_block(const block_state_ptr& new_bs) const;
+      void evaluate_block_handoff(const signed_block_ptr& block);
 
       boost::program_options::variables_map _options;
       bool     _production_enabled                 = false;
@@ -134,8 +143,36 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
       int32_t                                                   _produce_time_offset_us = 0;
       int32_t                                                   _last_block_time_offset_us = 0;
       fc::time_point                                            _irreversible_block_time;
+
+      // adaptive block time offsets, tuned on whether the next producer builds on the last block of our round
+      static constexpr int32_t                                  handoff_backoff_us = 20000;
+      static constexpr int32_t                                  handoff_recovery_us = 2000;
+      struct block_handoff {
+         block_id_type        id;
+         uint32_t             block_num = 0;
+         block_timestamp_type timestamp;
+      };
+      bool                                                      _adaptive_block_time_offset = false;
+      int32_t                                                   _min_block_time_offset_us = 0;
+      int32_t                                                   _max_block_time_offset_us = 0;
+      fc::optional<block_handoff>                               _pending_handoff;
+      int64_t                                                   _handoff_latency_us = 0; ///< moving average
       fc::microseconds                                          _keosd_provider_timeout_us;
 
+      // when pipelined, blocks are signed on _signing_thread while the next block is started
+      bool                                                      _pipelined_block_signing = false;
+      boost::asio::io_service                                   _signing_ios;
+      fc::optional<boost::asio::io_service::work>               _signing_work;
+      std::thread                                               _signing_thread;
+      std::future<chain::signature_type>                        _pending_block_signature;
+
+      // incoming transactions are validated against _admission_snapshot on _admission_threads before the main thread sees them
+      uint16_t                                                  _admission_thread_count = 0;
+      boost::asio::io_service                                   _admission_ios;
+      fc::optional<boost::asio::io_service::work>               _admission_work;
+      std::vector<std::thread>                                  _admission_threads;
+      std::shared_ptr<const admission_snapshot>                 _admission_snapshot;
+
       time_point _last_signed_block_time;
       time_point _start_time = fc::time_point::now();
       uint32_t   _last_signed_block_num = 0;
@@ -171,7 +208,17 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
       double _incoming_trx_weight = 0.0;
       double _incoming_defer_ratio = 1.0; // 1:1
 
+      // bounds the work spent on scheduled (deferred) transactions per block
+      static constexpr size_t max_scheduled_transaction_window = 1000;
+      // unapplied transactions are ordered by the incoming queue policy this many at a time, oldest first
+      static constexpr size_t max_unapplied_transaction_window = 1000;
+      int32_t _max_scheduled_transaction_time_per_block_ms = -1;
+
       void on_block( const block_state_ptr& bsp ) {
+         if( _admission_snapshot ) {
+            _admission_snapshot = _admission_snapshot->next( app().get_plugin<chain_plugin>().chain(), bsp );
+         }
+
          if( bsp->header.timestamp <= _last_signed_block_time ) return;
          if( bsp->header.timestamp <= _start_time ) return;
          if( bsp->block_num <= _last_signed_block_num ) return;
@@ -280,6 +327,9 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
       void on_incoming_block(const signed_block_ptr& block) {
          fc_dlog(_log, "received incoming block ${id}", ("id", block->id()));
 
+         // our own last block must be complete before anything can be built on top of it
+         complete_block_signature();
+
          EOS_ASSERT( block->timestamp < (fc::time_point::now() + fc::seconds(7)), block_from_the_future, "received a block from the future, ignoring it" );
 
 
@@ -290,6 +340,10 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
          auto existing = chain.fetch_block_by_id( id );
          if( existing ) { return; }
 
+         if( _adaptive_block_time_offset ) {
+            evaluate_block_handoff( block );
+         }
+
          // abort the pending block
          chain.abort_block();
 
@@ -331,12 +385,84 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
          }
       }
 
-      std::deque<std::tuple<packed_transaction_ptr, bool, next_function<transaction_trace_ptr>>> _pending_incoming_transactions;
+      using pending_incoming_transaction = std::tuple<packed_transaction_ptr, bool, next_function<transaction_trace_ptr>, transaction_metadata_ptr>;
+      transaction_queue<pending_incoming_transaction> _pending_incoming_transactions;
+
+      /// share of the total CPU weight staked to account, scaled to transaction_queue's weight range
+      static int64_t account_cpu_weight(const account_name& account) {
+         const auto& chain = app().get_plugin<chain_plugin>().chain();
+         if (!account_exists(chain, account)) return 0;
+         int64_t ram_bytes, net_weight, cpu_weight;
+         chain.get_resource_limits_manager().get_account_limits(account, ram_bytes, net_weight, cpu_weight);
+         uint64_t total_cpu_weight = chain.db().get<resource_limits::resource_limits_state_object>().total_cpu_weight;
+         if (cpu_weight <= 0 || total_cpu_weight == 0) return cpu_weight;
+         constexpr auto max_weight = transaction_queue<transaction_id_type>::max_weight;
+         return int64_t( std::min<uint128_t>( (uint128_t)cpu_weight * max_weight / total_cpu_weight, max_weight ) );
+      }
+
+      void queue_incoming_transaction(const packed_transaction_ptr& trx, const transaction_metadata_ptr& mtrx, bool persist_until_expired, next_function<transaction_trace_ptr> next) {
+         auto first_authorizer = _pending_incoming_transactions.orders_by_account() ? trx->get_transaction().first_authorizor() : account_name();
+         _pending_incoming_transactions.push_back(pending_incoming_transaction(trx, persist_until_expired, next, mtrx), first_authorizer, trx->expiration());
+      }
+
+      subjective_billing _subjective_billing;
+
+      static bool account_exists(const chain::controller& chain, const account_name& account) {
+         return chain.db().find<resource_limits::resource_usage_object, resource_limits::by_owner>(account) != nullptr;
+      }
+
+      /// true if CPU spent on failed transactions of account exceeds the CPU it has available on chain
+      bool exceeds_subjective_budget(const account_name& account) const {
+         return _subjective_billing.exceeds_available_cpu(app().get_plugin<chain_plugin>().chain(), account, fc::time_point::now());
+      }
+
+      void bill_failed_transaction(const account_name& first_authorizer, fc::microseconds elapsed) {
+         _subjective_billing.bill(app().get_plugin<chain_plugin>().chain(), first_authorizer, elapsed, fc::time_point::now());
+      }
 
       void on_incoming_transaction_async(const packed_transaction_ptr& trx, bool persist_until_expired, next_function<transaction_trace_ptr> next) {
+         if (_admission_threads.empty()) {
+            process_incoming_transaction(trx, transaction_metadata_ptr(), persist_until_expired, next);
+            return;
+         }
+
+         // packed_transaction unpacks into a mutable cache on first use; fill it here so the admission thread only reads it
+         trx->get_transaction();
+         trx->id();
+
+         std::weak_ptr<producer_plugin_impl> weak_this = shared_from_this();
+         _admission_ios.post([weak_this, trx, persist_until_expired, next, snapshot = _admission_snapshot]() {
+            transaction_metadata_ptr mtrx;
+            fc::exception_ptr except;
+            try {
+               mtrx = std::make_shared<transaction_metadata>(*trx);
+               validate_for_admission(*snapshot, *mtrx);
+            } catch ( const fc::exception& e ) {
+               except = e.dynamic_copy_exception();
+            } catch ( const std::exception& e ) {
+               except = std::make_shared<fc::exception>(FC_LOG_MESSAGE(error, "Caught std::exception: ${what}", ("what", e.what())),
+                                                        fc::std_exception_code, BOOST_CORE_TYPEID(e).name(), e.what());
+            }
+
+            app().get_io_service().post([weak_this, trx, mtrx, except, persist_until_expired, next]() {
+               auto self = weak_this.lock();
+               if (!self) return;
+               if (except) {
+                  fc_dlog(_log, "transaction ${id} rejected on admission: ${e}", ("id", trx->id())("e", except->to_string()));
+                  next(except);
+                  self->_transaction_ack_channel.publish(std::pair<fc::exception_ptr, packed_transaction_ptr>(except, trx));
+               } else {
+                  self->process_incoming_transaction(trx, mtrx, persist_until_expired, next);
+               }
+            });
+         });
+      }
+
+      /// @param mtrx metadata already validated by the admission threads, if any
+      void process_incoming_transaction(const packed_transaction_ptr& trx, transaction_metadata_ptr mtrx, bool persist_until_expired, next_function<transaction_trace_ptr> next) {
          chain::controller& chain = app().get_plugin<chain_plugin>().chain();
          if (!chain.pending_block_state()) {
-            _pending_incoming_transactions.emplace_back(trx, persist_until_expired, next);
+            queue_incoming_transaction(trx, mtrx, persist_until_expired, next);
             return;
          }
 
@@ -370,11 +496,21 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
          }
 
          try {
-            auto trace = chain.push_transaction(std::make_shared<transaction_metadata>(*trx), deadline);
+            if (!mtrx) {
+               mtrx = std::make_shared<transaction_metadata>(*trx);
+            }
+            auto first_authorizer = mtrx->trx.first_authorizor();
+            if (!_subjective_billing.is_disabled() && exceeds_subjective_budget(first_authorizer)) {
+               send_response(std::static_pointer_cast<fc::exception>(std::make_shared<tx_cpu_usage_exceeded>(FC_LOG_MESSAGE(error, "transaction ${id} rejected, ${a} exceeded its CPU with failed transactions", ("id", id)("a", first_authorizer)) )));
+               return;
+            }
+
+            auto trace = chain.push_transaction(mtrx, deadline);
             if (trace->except) {
                if (failure_is_subjective(*trace->except, deadline_is_subjective)) {
-                  _pending_incoming_transactions.emplace_back(trx, persist_until_expired, next);
+                  queue_incoming_transaction(trx, mtrx, persist_until_expired, next);
                } else {
+                  bill_failed_transaction(first_authorizer, trace->elapsed);
                   auto e_ptr = trace->except->dynamic_copy_exception();
                   send_response(e_ptr);
                }
@@ -486,8 +622,28 @@ void producer_plugin::set_program_options(
           "offset of non last block producing time in micro second. Negative number results in blocks to go out sooner, and positive number results in blocks to go out later")
          ("last-block-time-offset-us", boost::program_options::value<int32_t>()->default_value(0),
           "offset of last block producing time in micro second. Negative number results in blocks to go out sooner, and positive number results in blocks to go out later")
+         ("adaptive-block-time-offset", boost::program_options::bool_switch()->notifier([this](bool a){my->_adaptive_block_time_offset = a;}),
+          "Tune produce-time-offset-us and last-block-time-offset-us automatically: offsets move earlier when the next producer does not build on the last blocks of our round, and drift back later while it does")
+         ("adaptive-block-time-offset-min-us", boost::program_options::value<int32_t>()->default_value(-250000),
+          "earliest offset in micro second the adaptive block time offset may choose")
+         ("adaptive-block-time-offset-max-us", boost::program_options::value<int32_t>()->default_value(0),
+          "latest offset in micro second the adaptive block time offset may choose")
+         ("pipelined-block-signing", boost::program_options::bool_switch()->notifier([this](bool p){my->_pipelined_block_signing = p;}),
+          "Sign produced blocks on a separate thread while the next block is started. Signature providers must be safe to call from that thread")
+         ("transaction-admission-threads", bpo::value<uint16_t>()->default_value(0),
+          "Number of threads that check incoming transactions for expiration, size limits, TaPoS against irreversible blocks and the key blacklist, and recover their signatures, before they reach the main thread; 0 checks them on the main thread while applying them")
          ("incoming-defer-ratio", bpo::value<double>()->default_value(1.0),
           "ratio between incoming transations and deferred transactions when both are exhausted")
+         ("max-scheduled-transaction-time-per-block-ms", bpo::value<int32_t>()->default_value(-1),
+          "Maximum wall-clock time, in milliseconds, spent executing scheduled transactions in each produced block. -1 for unlimited")
+         ("disable-subjective-billing", boost::program_options::bool_switch()->notifier([this](bool d){ if (d) my->_subjective_billing.disable(); }),
+          "Do not charge the CPU time of failed transactions to their first authorizer. When enabled, transactions of accounts whose failed CPU time exceeds their available CPU are rejected")
+         ("incoming-transaction-queue-policy", bpo::value<string>()->default_value("fifo"),
+          "Order in which queued incoming and unapplied transactions are applied when producing. Valid options are:\n"
+          "fifo: in order of arrival\n"
+          "account-fair: round robin across the first authorizers of the transactions\n"
+          "cpu-weighted: each first authorizer gets a share proportional to its CPU weight\n"
+          "earliest-expiry: transactions closest to their expiration first")
          ;
    config_file_options.add(producer_options);
 }
@@ -604,12 +760,31 @@ void producer_plugin::plugin_initialize(const boost::program_options::variables_
 
    my->_last_block_time_offset_us = options.at("last-block-time-offset-us").as<int32_t>();
 
+   my->_min_block_time_offset_us = options.at("adaptive-block-time-offset-min-us").as<int32_t>();
+   my->_max_block_time_offset_us = options.at("adaptive-block-time-offset-max-us").as<int32_t>();
+   if (my->_adaptive_block_time_offset) {
+      EOS_ASSERT( my->_min_block_time_offset_us <= my->_max_block_time_offset_us, plugin_config_exception,
+                  "adaptive-block-time-offset-min-us must not be greater than adaptive-block-time-offset-max-us" );
+      auto clamp = [&]( int32_t offset ) {
+         return std::min( std::max( offset, my->_min_block_time_offset_us ), my->_max_block_time_offset_us );
+      };
+      my->_produce_time_offset_us = clamp( my->_produce_time_offset_us );
+      my->_last_block_time_offset_us = clamp( my->_last_block_time_offset_us );
+   }
+
    my->_max_transaction_time_ms = options.at("max-transaction-time").as<int32_t>();
 
    my->_max_irreversible_block_age_us = fc::seconds(options.at("max-irreversible-block-age").as<int32_t>());
 
    my->_incoming_defer_ratio = options.at("incoming-defer-ratio").as<double>();
 
+   my->_max_scheduled_transaction_time_per_block_ms = options.at("max-scheduled-transaction-time-per-block-ms").as<int32_t>();
+
+   my->_admission_thread_count = options.at("transaction-admission-threads").as<uint16_t>();
+
+   auto queue_policy = transaction_queue_policy_from_string(options.at("incoming-transaction-queue-policy").as<string>());
+   my->_pending_incoming_transactions = transaction_queue<producer_plugin_impl::pending_incoming_transaction>(queue_policy, &producer_plugin_impl::account_cpu_weight);
+
    my->_incoming_block_subscription = app().get_channel<incoming::channels::block>().subscribe([this](const signed_block_ptr& block){
       try {
          my->on_incoming_block(block);
@@ -679,6 +854,23 @@ void producer_plugin::plugin_startup()
       }
    }
 
+   if (my->_admission_thread_count > 0) {
+      my->_admission_snapshot = admission_snapshot::create(chain);
+      my->_admission_work.emplace(my->_admission_ios);
+      for (uint16_t i = 0; i < my->_admission_thread_count; ++i) {
+         my->_admission_threads.emplace_back([this]() {
+            my->_admission_ios.run();
+         });
+      }
+   }
+
+   if (my->_pipelined_block_signing && !my->_producers.empty()) {
+      my->_signing_work.emplace(my->_signing_ios);
+      my->_signing_thread = std::thread([this]() {
+         my->_signing_ios.run();
+      });
+   }
+
    my->schedule_production_loop();
 
    ilog("producer plugin:  plugin_startup() end");
@@ -687,10 +879,26 @@ void producer_plugin::plugin_startup()
 void producer_plugin::plugin_shutdown() {
    try {
       my->_timer.cancel();
+      my->complete_block_signature();
    } catch(fc::exception& e) {
       edump((e.to_detail_string()));
    }
 
+   if (!my->_admission_threads.empty()) {
+      my->_admission_work.reset();
+      my->_admission_ios.stop();
+      for (auto& t : my->_admission_threads) {
+         t.join();
+      }
+      my->_admission_threads.clear();
+   }
+
+   if (my->_signing_thread.joinable()) {
+      my->_signing_work.reset();
+      my->_signing_ios.stop();
+      my->_signing_thread.join();
+   }
+
    my->_accepted_block_connection.reset();
    my->_irreversible_block_connection.reset();
 }
@@ -774,6 +982,10 @@ void producer_plugin::remove_greylist_accounts(const greylist_params& params) {
    }
 }
 
+transaction_queue_metrics producer_plugin::get_incoming_transaction_queue() const {
+   return my->_pending_incoming_transactions.get_metrics();
+}
+
 producer_plugin::greylist_params producer_plugin::get_greylist() const {
    chain::controller& chain = app().get_plugin<chain_plugin>().chain();
    greylist_params result;
@@ -805,6 +1017,10 @@ void producer_plugin::set_whitelist_blacklist(const producer_plugin::whitelist_b
    if(params.contract_blacklist.valid()) chain.set_contract_blacklist(*params.contract_blacklist);
    if(params.action_blacklist.valid()) chain.set_action_blacklist(*params.action_blacklist);
    if(params.key_blacklist.valid()) chain.set_key_blacklist(*params.key_blacklist);
+
+   if (my->_admission_snapshot) {
+      my->_admission_snapshot = admission_snapshot::create(chain);
+   }
 }
 
 
@@ -969,57 +1185,87 @@ producer_plugin_impl::start_block_result producer_plugin_impl::start_block(bool
       bool exhausted = false;
 
       // remove all persisted transactions that have now expired
-      auto& persisted_by_id = _persistent_transactions.get<by_id>();
       auto& persisted_by_expiry = _persistent_transactions.get<by_expiry>();
       while(!persisted_by_expiry.empty() && persisted_by_expiry.begin()->expiry <= pbs->header.timestamp.to_time_point()) {
          persisted_by_expiry.erase(persisted_by_expiry.begin());
       }
 
+      _subjective_billing.remove_expired(now);
+
       try {
          size_t orig_pending_txn_size = _pending_incoming_transactions.size();
 
          if (!persisted_by_expiry.empty() || _pending_block_mode == pending_block_mode::producing) {
-            auto unapplied_trxs = chain.get_unapplied_transactions();
+            chain.drop_expired_unapplied_transactions(pbs->header.timestamp.to_time_point());
+            const auto& unapplied_trxs = chain.get_unapplied_transaction_queue();
+            std::set<transaction_id_type> persisted_tried;
 
             if (!persisted_by_expiry.empty()) {
-               for (auto itr = unapplied_trxs.begin(); itr != unapplied_trxs.end(); ++itr) {
-                  const auto& trx = *itr;
-                  if (persisted_by_id.find(trx->id) != persisted_by_id.end()) {
-                     // this is a persisted transaction, push it into the block (even if we are speculating) with
-                     // no deadline as it has already passed the subjective deadlines once and we want to represent
-                     // the state of the chain including this transaction
-                     try {
-                        chain.push_transaction(trx, fc::time_point::maximum());
-                     } catch ( const guard_exception& e ) {
-                        app().get_plugin<chain_plugin>().handle_guard_exception(e);
-                        return start_block_result::failed;
-                     } FC_LOG_AND_DROP();
-
-                     // remove it from further consideration as it is applied
-                     *itr = nullptr;
-                  }
+               // there are usually far fewer persisted transactions than unapplied ones, so look them up
+               for (const auto& persisted : persisted_by_expiry) {
+                  auto trx = unapplied_trxs.find(persisted.trx_id);
+                  if (!trx) continue;
+                  persisted_tried.insert(persisted.trx_id);
+
+                  // this is a persisted transaction, push it into the block (even if we are speculating) with
+                  // no deadline as it has already passed the subjective deadlines once and we want to represent
+                  // the state of the chain including this transaction
+                  try {
+                     chain.push_transaction(trx, fc::time_point::maximum());
+                  } catch ( const guard_exception& e ) {
+                     app().get_plugin<chain_plugin>().handle_guard_exception(e);
+                     return start_block_result::failed;
+                  } FC_LOG_AND_DROP();
                }
             }
 
             if (_pending_block_mode == pending_block_mode::producing) {
-               for (const auto& trx : unapplied_trxs) {
+               // replay in the same order the incoming queue would hand them out. Arrival order needs no copy; the other
+               // policies order a window of the oldest transactions at a time, looking each CPU weight up once per block
+               const bool in_arrival_order = _pending_incoming_transactions.policy() == transaction_queue_policy::fifo;
+               std::map<account_name, int64_t> cpu_weights;
+               auto cached_cpu_weight = [&cpu_weights](const account_name& account) {
+                  auto itr = cpu_weights.find(account);
+                  if (itr == cpu_weights.end()) {
+                     itr = cpu_weights.emplace(account, account_cpu_weight(account)).first;
+                  }
+                  return itr->second;
+               };
+               transaction_queue<transaction_metadata_ptr> ordered_trxs(_pending_incoming_transactions.policy(), cached_cpu_weight);
+
+               auto unapplied_itr = unapplied_trxs.begin();
+               auto next_unapplied = [&]() -> transaction_metadata_ptr {
+                  if (in_arrival_order) {
+                     // advance before the transaction is pushed, which removes its entry when it succeeds
+                     return unapplied_itr != unapplied_trxs.end() ? (unapplied_itr++)->trx_meta : transaction_metadata_ptr();
+                  }
+                  if (ordered_trxs.empty()) {
+                     // the whole window is taken before any of it is pushed, so unapplied_itr stays ahead of the removed entries
+                     for (; unapplied_itr != unapplied_trxs.end() && ordered_trxs.size() < max_unapplied_transaction_window; ++unapplied_itr) {
+                        ordered_trxs.push_back(transaction_metadata_ptr(unapplied_itr->trx_meta), unapplied_itr->trx_meta->trx.first_authorizor(), unapplied_itr->expiry);
+                     }
+                  }
+                  return ordered_trxs.empty() ? transaction_metadata_ptr() : ordered_trxs.pop_front();
+               };
+
+               while (auto trx = next_unapplied()) {
                   if (block_time <= fc::time_point::now()) exhausted = true;
                   if (exhausted) {
                      break;
                   }
 
-                  if (!trx) {
-                     // nulled in the loop above, skip it
-                     continue;
-                  }
-
-                  if (trx->packed_trx.expiration() < pbs->header.timestamp.to_time_point()) {
-                     // expired, drop it
-                     chain.drop_unapplied_transaction(trx);
+                  if (persisted_tried.count(trx->id)) {
+                     // a persisted transaction left unapplied failed above, it is tried again in the next block
                      continue;
                   }
 
                   try {
+                     const auto first_authorizer = trx->trx.first_authorizor();
+                     if (!_subjective_billing.is_disabled() && exceeds_subjective_budget(first_authorizer)) {
+                        // leave it unapplied, it may fit once the failures of its authorizer decay
+                        continue;
+                     }
+
                      auto deadline = fc::time_point::now() + fc::milliseconds(_max_transaction_time_ms);
                      bool deadline_is_subjective = false;
                      if (_max_transaction_time_ms < 0 || (_pending_block_mode == pending_block_mode::producing && block_time < deadline)) {
@@ -1033,6 +1279,7 @@ producer_plugin_impl::start_block_result producer_plugin_impl::start_block(bool
                            exhausted = true;
                         } else {
                            // this failed our configured maximum transaction time, we don't want to replay it
+                           bill_failed_transaction(first_authorizer, trace->elapsed);
                            chain.drop_unapplied_transaction(trx);
                         }
                      }
@@ -1053,21 +1300,35 @@ producer_plugin_impl::start_block_result producer_plugin_impl::start_block(bool
                blacklist_by_expiry.erase(blacklist_by_expiry.begin());
             }
 
-            auto scheduled_trxs = chain.get_scheduled_transactions();
+            // only a bounded window of the due scheduled transactions is looked at, handed out round robin across payers;
+            // blacklisted ones are skipped without taking a place in the window, so they cannot starve the others
+            transaction_queue<transaction_id_type> scheduled_trxs(transaction_queue_policy::account_fair);
+            chain.for_each_scheduled_transaction([&](const transaction_id_type& id, const account_name& payer) {
+               if (blacklist_by_id.find(id) == blacklist_by_id.end()) {
+                  scheduled_trxs.push_back(transaction_id_type(id), payer, fc::time_point());
+               }
+               return scheduled_trxs.size() < max_scheduled_transaction_window;
+            });
+
+            // only time spent on scheduled transactions counts, not the incoming ones interleaved with them
+            const bool scheduled_time_limited = _max_scheduled_transaction_time_per_block_ms >= 0;
+            const auto max_scheduled_time = fc::milliseconds(_max_scheduled_transaction_time_per_block_ms);
+            fc::microseconds scheduled_time;
 
-            for (const auto& trx : scheduled_trxs) {
+            while (!scheduled_trxs.empty()) {
                if (block_time <= fc::time_point::now()) exhausted = true;
-               if (exhausted) {
+               if (exhausted || (scheduled_time_limited && scheduled_time >= max_scheduled_time)) {
                   break;
                }
 
+               auto trx = scheduled_trxs.pop_front();
+
                // configurable ratio of incoming txns vs deferred txns
                while (_incoming_trx_weight >= 1.0 && orig_pending_txn_size && _pending_incoming_transactions.size()) {
-                  auto e = _pending_incoming_transactions.front();
-                  _pending_incoming_transactions.pop_front();
+                  auto e = _pending_incoming_transactions.pop_front();
                   --orig_pending_txn_size;
                   _incoming_trx_weight -= 1.0;
-                  on_incoming_transaction_async(std::get<0>(e), std::get<1>(e), std::get<2>(e));
+                  process_incoming_transaction(std::get<0>(e), std::get<3>(e), std::get<1>(e), std::get<2>(e));
                }
 
                if (block_time <= fc::time_point::now()) {
@@ -1075,10 +1336,10 @@ producer_plugin_impl::start_block_result producer_plugin_impl::start_block(bool
                   break;
                }
 
-               if (blacklist_by_id.find(trx) != blacklist_by_id.end()) {
-                  continue;
-               }
-
+               const auto scheduled_start = fc::time_point::now();
+               auto add_scheduled_time = fc::make_scoped_exit([&]() {
+                  scheduled_time += fc::time_point::now() - scheduled_start;
+               });
                try {
                   auto deadline = fc::time_point::now() + fc::milliseconds(_max_transaction_time_ms);
                   bool deadline_is_subjective = false;
@@ -1113,10 +1374,9 @@ producer_plugin_impl::start_block_result producer_plugin_impl::start_block(bool
             // attempt to apply any pending incoming transactions
             _incoming_trx_weight = 0.0;
             if (orig_pending_txn_size && _pending_incoming_transactions.size()) {
-               auto e = _pending_incoming_transactions.front();
-               _pending_incoming_transactions.pop_front();
+               auto e = _pending_incoming_transactions.pop_front();
                --orig_pending_txn_size;
-               on_incoming_transaction_async(std::get<0>(e), std::get<1>(e), std::get<2>(e));
+               process_incoming_transaction(std::get<0>(e), std::get<3>(e), std::get<1>(e), std::get<2>(e));
                if (block_time <= fc::time_point::now()) return start_block_result::exhausted;
             }
             return start_block_result::succeeded;
@@ -1267,6 +1527,7 @@ static auto maybe_make_debug_time_logger() -> fc::optional<decltype(make_debug_t
 void producer_plugin_impl::produce_block() {
    //ilog("produce_block ${t}", ("t", fc::time_point::now())); // for testing _produce_time_offset_us
    EOS_ASSERT(_pending_block_mode == pending_block_mode::producing, producer_exception, "called produce_block while not actually producing");
+   EOS_ASSERT(complete_block_signature(), producer_exception, "previous block could not be signed");
    chain::controller& chain = app().get_plugin<chain_plugin>().chain();
    const auto& pbs = chain.pending_block_state();
    const auto& hbs = chain.head_block_state();
@@ -1277,18 +1538,86 @@ void producer_plugin_impl::produce_block() {
 
    //idump( (fc::time_point::now() - chain.pending_block_time()) );
    chain.finalize_block();
-   chain.sign_block( [&]( const digest_type& d ) {
-      auto debug_logger = maybe_make_debug_time_logger();
-      return signature_provider_itr->second(d);
-   } );
 
-   chain.commit_block();
+   if (_signing_thread.joinable()) {
+      // sign on the signing thread and commit right away, so the next block starts while the signature is produced
+      auto signature = std::make_shared<std::promise<chain::signature_type>>();
+      _pending_block_signature = signature->get_future();
+      std::weak_ptr<producer_plugin_impl> weak_this = shared_from_this();
+      _signing_ios.post([signature, weak_this, signer = signature_provider_itr->second, digest = pbs->sig_digest()]() {
+         try {
+            auto debug_logger = maybe_make_debug_time_logger();
+            signature->set_value(signer(digest));
+         } catch (...) {
+            signature->set_exception(std::current_exception());
+         }
+         app().get_io_service().post([weak_this]() {
+            auto self = weak_this.lock();
+            if (self && !self->complete_block_signature()) {
+               self->schedule_production_loop();
+            }
+         });
+      });
+
+      chain.commit_block_before_signing();
+   } else {
+      chain.sign_block( [&]( const digest_type& d ) {
+         auto debug_logger = maybe_make_debug_time_logger();
+         return signature_provider_itr->second(d);
+      } );
+
+      chain.commit_block();
+   }
    auto hbt = chain.head_block_time();
    //idump((fc::time_point::now() - hbt));
 
    block_state_ptr new_bs = chain.head_block_state();
    _producer_watermarks[new_bs->header.producer] = chain.head_block_num();
 
+   if (_adaptive_block_time_offset) {
+      // the next block produced by someone else tells whether the last block of this round reached them in time
+      if ((new_bs->header.timestamp.slot % config::producer_repetitions) == config::producer_repetitions - 1) {
+         _pending_handoff = block_handoff{new_bs->id, new_bs->block_num, new_bs->header.timestamp};
+      } else {
+         _pending_handoff.reset();
+      }
+   }
+
+   if (!_pending_block_signature.valid()) {
+      log_produced_block(new_bs);
+   }
+}
+
+/**
+ * Waits for the signature of the last block produced with pipelined signing, if any, and completes it.
+ * @return false if the block could not be signed and was discarded
+ */
+bool producer_plugin_impl::complete_block_signature() {
+   if (!_pending_block_signature.valid()) return true;
+
+   chain::controller& chain = app().get_plugin<chain_plugin>().chain();
+   auto new_bs = chain.unsigned_head_block_state();
+   try {
+      auto sig = _pending_block_signature.get();
+      if (!new_bs) return true; // the block failed to commit
+      chain.complete_block_signature(sig);
+   } catch ( const guard_exception& e ) {
+      app().get_plugin<chain_plugin>().handle_guard_exception(e);
+      return true;
+   } catch ( ... ) {
+      if (!new_bs) return true;
+      elog("Failed to sign block #${n}, discarding it", ("n", new_bs->block_num));
+      chain.discard_unsigned_block();
+      _pending_handoff.reset();
+      return false;
+   }
+
+   log_produced_block(new_bs);
+   return true;
+}
+
+void producer_plugin_impl::log_produced_block(const block_state_ptr& new_bs) const {
+   chain::controller& chain = app().get_plugin<chain_plugin>().chain();
    ilog("Produced block ${id}... #${n} @ ${t} signed by ${p} [trxs: ${count}, lib: ${lib}, confirmed: ${confs}]",
         ("p",new_bs->header.producer)("id",fc::variant(new_bs->id).as_string().substr(0,16))
         ("n",new_bs->block_num)("t",new_bs->header.timestamp)
@@ -1296,4 +1625,43 @@ void producer_plugin_impl::produce_block() {
 
 }
 
+/**
+ * Called with the first block received from another producer after the last block of one of our rounds.
+ * If it does not build on that block, the blocks it skipped reached the next producer too late and the
+ * offsets move earlier by at least the observed block latency; if it does, they slowly drift back later.
+ */
+void producer_plugin_impl::evaluate_block_handoff(const signed_block_ptr& block) {
+   if (!_pending_handoff || block->timestamp <= _pending_handoff->timestamp) return;
+   if (_producers.count(block->producer) > 0) return;
+
+   auto handoff = *_pending_handoff;
+   _pending_handoff.reset();
+
+   // time from the end of the next producer's slot until its block reached us
+   auto latency_us = std::max<int64_t>( (fc::time_point::now() - block->timestamp.to_time_point()).count(), 0 );
+   _handoff_latency_us = _handoff_latency_us == 0 ? latency_us : (3 * _handoff_latency_us + latency_us) / 4;
+
+   auto adjust = [&]( int32_t& offset, int64_t delta ) {
+      offset = int32_t( std::min<int64_t>( std::max<int64_t>( offset + delta, _min_block_time_offset_us ), _max_block_time_offset_us ) );
+   };
+
+   uint32_t previous_num = block_header::num_from_id( block->previous );
+   if (block->previous == handoff.id) {
+      adjust( _last_block_time_offset_us, handoff_recovery_us );
+      adjust( _produce_time_offset_us, handoff_recovery_us );
+      fc_dlog(_log, "Block #${n} handed off to ${p}, block time offsets now ${o}/${l}us",
+              ("n", handoff.block_num)("p", block->producer)("o", _produce_time_offset_us)("l", _last_block_time_offset_us));
+   } else if (previous_num < handoff.block_num) {
+      auto missed = std::min<uint32_t>( handoff.block_num - previous_num, config::producer_repetitions );
+      auto backoff = std::max<int64_t>( handoff_backoff_us, _handoff_latency_us );
+      adjust( _last_block_time_offset_us, -backoff );
+      if (missed > 1) {
+         adjust( _produce_time_offset_us, -backoff );
+      }
+      ilog("${p} did not build on our last ${m} block(s), block time offsets now ${o}/${l}us",
+           ("p", block->producer)("m", missed)("o", _produce_time_offset_us)("l", _last_block_time_offset_us));
+   }
+   // otherwise the block is on a branch past ours and tells nothing about the hand-off
+}
+
 } // namespace eosio
@@ -0,0 +1,962 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ *
+ *  Simulated network of nodes running the net_plugin relay.
+ *
+ *  Every node is a controller (a tester) holding the relay state net_plugin_impl keeps for one node: the
+ *  transactions it relayed and, per peer, the prioritized send queues, the transactions the peer knows, the
+ *  compact blocks waiting for transactions from it and the sync ranges it serves. Messages are serialized,
+ *  compressed, queued, compacted and rebuilt by the code net_plugin uses (eosio/net_plugin/relay.hpp). What
+ *  this file provides instead of sockets, timers and the application is an in-memory link with configurable
+ *  latency, jitter, loss and bandwidth, and the handling of each message, which follows net_plugin_impl.
+ *  The choices net_plugin makes, which peer to sync from, in which order to relay to peers, which announced
+ *  transactions to request, are taken by the same relay.hpp code, fed the round trips measured on the links.
+ *
+ *  Node 0 produces the blocks and transactions enter the network at random other nodes. The last --late-nodes
+ *  nodes come online at --join-block and catch up from several peers at once. Time is simulated: deliveries
+ *  advance a virtual clock, and the real time a node spends applying a message keeps that node busy on the
+ *  virtual clock too. Decoding and compressing run beside the main thread, as in net_plugin, so they delay
+ *  a message without keeping the node busy. With the same options and seed, everything but those measured
+ *  processing times is repeatable.
+ *
+ *  Options follow --, for example
+ *     net_simulation -- --nodes 16 --peers 4 --latency-ms 50 --loss 0.01 --bandwidth-mbps 20 --late-nodes 2
+ */
+#include <eosio/testing/tester.hpp>
+#include <eosio/chain/contract_types.hpp>
+#include <eosio/net_plugin/protocol.hpp>
+#include <eosio/net_plugin/relay.hpp>
+
+#include <fc/io/raw.hpp>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <random>
+#include <set>
+
+using namespace eosio;
+using namespace eosio::chain;
+using namespace eosio::testing;
+namespace bpo = boost::program_options;
+
+namespace {
+
+   struct simulation_options {
+      uint32_t nodes = 8;
+      uint32_t peers = 2;            ///< links each node opens to random other nodes, on top of a ring
+      uint32_t blocks = 40;
+      uint32_t trxs_per_block = 20;
+      uint32_t latency_ms = 20;      ///< one way
+      uint32_t latency_spread_ms = 20; ///< each link adds up to this much to latency_ms, for good
+      uint32_t jitter_ms = 5;
+      double   loss = 0;             ///< chance that a message waits for a retransmission, repeatedly
+      uint32_t retransmit_ms = 200;
+      uint32_t bandwidth_mbps = 100; ///< each direction of each link, 0 for unlimited
+      uint32_t seed = 1;
+
+      bool     compact_blocks = true;
+      uint32_t trx_announce_ms = 0;  ///< 0 pushes whole transactions
+      uint32_t trx_announce_max_ids = 1000;
+      bool     header_relay = false;
+      uint32_t late_nodes = 0;
+      uint32_t join_block = 0;       ///< 0 for halfway
+      uint32_t sync_span = 20;
+      uint32_t sync_sources = 3;
+      bool     sync_compression = true;
+      uint32_t sync_compression_min_size = 4096;
+   };
+
+   simulation_options parse_options() {
+      simulation_options o;
+      bpo::options_description desc( "net_simulation" );
+      desc.add_options()
+         ( "nodes", bpo::value<uint32_t>( &o.nodes )->default_value( o.nodes ), "number of nodes, node 0 produces every block" )
+         ( "peers", bpo::value<uint32_t>( &o.peers )->default_value( o.peers ), "random links opened by each node besides its ring neighbours" )
+         ( "blocks", bpo::value<uint32_t>( &o.blocks )->default_value( o.blocks ), "number of blocks to produce" )
+         ( "trxs-per-block", bpo::value<uint32_t>( &o.trxs_per_block )->default_value( o.trxs_per_block ), "transactions sent into the network per block interval" )
+         ( "latency-ms", bpo::value<uint32_t>( &o.latency_ms )->default_value( o.latency_ms ), "one way link latency" )
+         ( "latency-spread-ms", bpo::value<uint32_t>( &o.latency_spread_ms )->default_value( o.latency_spread_ms ), "random latency added to each link for the whole run, up to this much" )
+         ( "jitter-ms", bpo::value<uint32_t>( &o.jitter_ms )->default_value( o.jitter_ms ), "random latency added to each message, up to this much" )
+         ( "loss", bpo::value<double>( &o.loss )->default_value( o.loss ), "chance that a message is lost and has to be retransmitted, below 1" )
+         ( "retransmit-ms", bpo::value<uint32_t>( &o.retransmit_ms )->default_value( o.retransmit_ms ), "delay added by each retransmission" )
+         ( "bandwidth-mbps", bpo::value<uint32_t>( &o.bandwidth_mbps )->default_value( o.bandwidth_mbps ), "link bandwidth in each direction, 0 for unlimited" )
+         ( "seed", bpo::value<uint32_t>( &o.seed )->default_value( o.seed ), "seed of the topology, load and link behaviour" )
+         ( "compact-blocks", bpo::value<bool>( &o.compact_blocks )->default_value( o.compact_blocks ), "relay blocks with the transactions peers already have reduced to their ids" )
+         ( "trx-announce-ms", bpo::value<uint32_t>( &o.trx_announce_ms )->default_value( o.trx_announce_ms ), "announce transaction ids in batches this often instead of pushing transactions, 0 to push" )
+         ( "trx-announce-max-ids", bpo::value<uint32_t>( &o.trx_announce_max_ids )->default_value( o.trx_announce_max_ids ), "announce early once this many ids are pending for a peer" )
+         ( "header-relay", bpo::value<bool>( &o.header_relay )->default_value( o.header_relay ), "relay a block once its header validates, before applying it" )
+         ( "late-nodes", bpo::value<uint32_t>( &o.late_nodes )->default_value( o.late_nodes ), "nodes that come online late and sync, taken from the end" )
+         ( "join-block", bpo::value<uint32_t>( &o.join_block )->default_value( o.join_block ), "block after which the late nodes come online, 0 for halfway" )
+         ( "sync-span", bpo::value<uint32_t>( &o.sync_span )->default_value( o.sync_span ), "blocks requested from a peer at a time while syncing" )
+         ( "sync-sources", bpo::value<uint32_t>( &o.sync_sources )->default_value( o.sync_sources ), "peers a syncing node requests ranges from at once" )
+         ( "sync-compression", bpo::value<bool>( &o.sync_compression )->default_value( o.sync_compression ), "compress blocks sent to syncing peers" )
+         ( "sync-compression-min-size", bpo::value<uint32_t>( &o.sync_compression_min_size )->default_value( o.sync_compression_min_size ), "smallest packed block that is compressed" );
+
+      auto& suite = boost::unit_test::framework::master_test_suite();
+      bpo::variables_map vm;
+      bpo::store( bpo::command_line_parser( suite.argc, suite.argv ).options( desc ).allow_unregistered().run(), vm );
+      bpo::notify( vm );
+      return o;
+   }
+
+   using sim_time = int64_t; ///< microseconds of simulated time
+
+   template<typename T>
+   T percentile( vector<T> values, double p ) {
+      if( values.empty() )
+         return T();
+      std::sort( values.begin(), values.end() );
+      return values[std::min( values.size() - 1, size_t( p * (values.size() - 1) + 0.5 ) )];
+   }
+
+   /// what the bytes on the links were spent on
+   enum traffic_kind : uint8_t {
+      block_traffic,    ///< blocks relayed at head, and the transactions of compact blocks
+      trx_traffic,      ///< transactions, and their announcements and requests
+      sync_traffic,     ///< blocks sent to syncing peers
+      control_traffic,  ///< sync requests
+      num_traffic_kinds
+   };
+
+   class network_simulation {
+   public:
+      explicit network_simulation( const simulation_options& o )
+      :opts(o), rng(o.seed), nodes(o.nodes)
+      {
+         BOOST_REQUIRE( opts.nodes > 0 );
+         BOOST_REQUIRE( opts.loss >= 0 && opts.loss < 1 );
+         BOOST_REQUIRE( opts.late_nodes < opts.nodes );
+         BOOST_REQUIRE( opts.sync_span > 0 && opts.sync_sources > 0 );
+         if( opts.join_block == 0 )
+            opts.join_block = opts.blocks / 2;
+
+         for( uint32_t i = 0; i < opts.nodes; ++i ) {
+            nodes[i].chain.reset( new tester( false ) );
+            nodes[i].online = !is_late( i );
+         }
+         eosio_key = tester::get_private_key( config::system_account_name, "active" );
+         account_key = eosio_key.get_public_key();
+
+         for( uint32_t i = 0; i + 1 < opts.nodes; ++i ) {
+            connect( i, (i + 1) % opts.nodes );
+         }
+         connect( opts.nodes - 1, 0 );
+         std::uniform_int_distribution<uint32_t> any_node( 0, opts.nodes - 1 );
+         for( uint32_t i = 0; opts.nodes > 2 && i < opts.nodes; ++i ) {
+            for( uint32_t p = 0; p < opts.peers; ++p ) {
+               connect( i, any_node( rng ) );
+            }
+         }
+      }
+
+      void run() {
+         const sim_time interval = config::block_interval_us;
+         uint32_t online_nodes = opts.nodes - opts.late_nodes;
+         std::uniform_int_distribution<uint32_t> origin_node( online_nodes > 1 ? 1 : 0, online_nodes - 1 );
+         for( uint32_t b = 1; b <= opts.blocks; ++b ) {
+            sim_time start = (b - 1) * interval;
+            for( uint32_t t = 0; t < opts.trxs_per_block; ++t ) {
+               auto origin = origin_node( rng );
+               schedule( start + (2 * t + 1) * interval / (2 * opts.trxs_per_block), [this, origin]( sim_time now ) {
+                  originate_transaction( origin, now );
+               });
+            }
+            schedule( start + interval, [this]( sim_time now ) { produce_block( now ); } );
+            if( opts.late_nodes && b == opts.join_block ) {
+               schedule( start + interval, [this]( sim_time now ) { join_late_nodes( now ); } );
+            }
+         }
+
+         while( !events.empty() ) {
+            auto e = events.top();
+            events.pop();
+            e.action( e.time );
+         }
+      }
+
+      /// every produced block reached every node
+      bool all_blocks_delivered()const {
+         for( const auto& n : nodes ) {
+            if( n.chain->control->head_block_num() != nodes[0].chain->control->head_block_num() )
+               return false;
+         }
+         return true;
+      }
+
+      void report( std::ostream& out )const {
+         vector<sim_time> arrivals;
+         vector<sim_time> full_propagation;
+         for( const auto& b : block_latencies ) {
+            arrivals.insert( arrivals.end(), b.second.begin(), b.second.end() );
+            if( !b.second.empty() )
+               full_propagation.push_back( *std::max_element( b.second.begin(), b.second.end() ) );
+         }
+         auto ms = []( sim_time us ) { return double(us) / 1000; };
+         auto per = []( uint64_t total, uint64_t count ) { return count ? double(total) / count : 0.0; };
+
+         out << std::fixed << std::setprecision(3);
+         out << "nodes " << opts.nodes << " (" << opts.late_nodes << " late), links " << link_count / 2 << ", blocks " << produced_blocks
+             << ", transactions " << sent_trxs << " sent, " << included_trxs << " included\n";
+         out << "block latency to each node (ms):  p50 " << ms( percentile( arrivals, 0.5 ) )
+             << "  p90 " << ms( percentile( arrivals, 0.9 ) )
+             << "  p99 " << ms( percentile( arrivals, 0.99 ) )
+             << "  max " << ms( percentile( arrivals, 1.0 ) ) << "\n";
+         out << "block latency to all nodes (ms):  p50 " << ms( percentile( full_propagation, 0.5 ) )
+             << "  p90 " << ms( percentile( full_propagation, 0.9 ) )
+             << "  max " << ms( percentile( full_propagation, 1.0 ) ) << "\n";
+         out << "bytes sent per block:             " << per( traffic[block_traffic], produced_blocks )
+             << " (" << per( traffic[block_traffic], produced_blocks * opts.nodes ) << " per node)\n";
+         out << "bytes sent per transaction:       " << per( traffic[trx_traffic], sent_trxs ) << "\n";
+         out << "compact blocks:                   " << compact_blocks << " received, " << incomplete_compact_blocks
+             << " missing " << missing_trxs << " transactions, " << full_block_requests << " full blocks requested\n";
+         if( ignored_announcements )
+            out << "announcements over the cap:       " << ignored_announcements << "\n";
+         out << "duplicates received:              " << duplicate_blocks << " blocks, " << duplicate_trxs << " transactions\n";
+         out << "rejected:                         " << rejected_blocks << " blocks, " << rejected_trxs << " transactions\n";
+         if( opts.late_nodes ) {
+            out << "sync time (ms):                   avg " << ms( sim_time( per( total_sync_time, sync_times.size() ) ) )
+                << "  max " << ms( percentile( sync_times, 1.0 ) ) << " over " << sync_times.size() << " of " << opts.late_nodes << " nodes\n";
+            out << "sync traffic:                     " << synced_blocks << " blocks in " << traffic[sync_traffic] << " bytes, "
+                << ignored_sync_blocks << " ignored, " << abandoned_syncs << " syncs abandoned\n";
+         }
+         out << "cpu per message (us):             decode " << per( decode_cpu_us, received_messages )
+             << "  produce " << per( produce_cpu_us, produced_blocks )
+             << "  apply block " << per( block_cpu_us, applied_blocks )
+             << "  apply transaction " << per( trx_cpu_us, trx_messages - duplicate_trxs ) << "\n";
+         out << "cpu total (ms):                   relay " << ms( relay_cpu_us ) << "  header " << ms( header_cpu_us )
+             << "  compress " << ms( compress_cpu_us ) << "\n";
+      }
+
+   private:
+      struct queued_write {
+         std::shared_ptr<vector<char>> buff;
+         traffic_kind                  kind;
+      };
+
+      /// what a node keeps for one of its peers, a net_plugin connection without the socket
+      struct peer_link {
+         peer_link( uint32_t p, sim_time l ) : peer(p), latency(l) {}
+
+         uint32_t                      peer;
+         sim_time                      latency;             ///< one way, before jitter and loss
+         int64_t                       rtt_us = -1;         ///< as measured by the node, -1 until the peer sent something
+         send_queues<queued_write>     write_queues;
+         bool                          writing = false;     ///< a write is on the wire
+         sim_time                      last_arrival = 0;    ///< the link delivers in order
+         peer_txn_filter               known_trxs;
+         compact_block_requests        pending_compact_blocks;
+         vector<transaction_id_type>   pending_trx_announce;
+         uint32_t                      sync_next = 0;       ///< next block of the range the peer requested
+         uint32_t                      sync_end = 0;        ///< 0 while the peer requested nothing
+         bool                          compressing_sync_block = false;
+         uint32_t                      flush_generation = 0; ///< drops sync blocks compressed before a flush
+      };
+      using link_ptr = std::shared_ptr<peer_link>;
+
+      struct node_state {
+         std::unique_ptr<tester>                      chain;
+         bool                                         online = true;
+         std::map<uint32_t, link_ptr>                 links; ///< by peer
+         node_transaction_index                       local_txns;
+         transaction_requests                         req_trx; ///< announced by a peer and requested from it
+         std::set<block_id_type>                      known_blocks;
+         std::map<block_id_type, std::set<uint32_t>>  received_from; ///< peers a block is not relayed back to
+         std::set<block_id_type>                      relayed_blocks; ///< relayed on their header, before being applied
+         std::map<uint32_t, std::pair<link_ptr, signed_block_ptr>> early_blocks; ///< received and not yet applied, by block number
+         bool                                         announce_pending = false;
+         sim_time                                     busy_until = 0;
+
+         sync_ranges<link_ptr>                        sync;
+         bool                                         syncing = false;
+         uint32_t                                     sync_known_num = 0;
+         uint32_t                                     sync_last_requested_num = 0;
+         uint32_t                                     sync_next_expected_num = 0;
+         link_ptr                                     sync_source; ///< the last peer a range was requested from
+         sim_time                                     sync_started = 0;
+      };
+
+      struct event {
+         sim_time                      time;
+         uint64_t                      seq;
+         std::function<void(sim_time)> action;
+
+         bool operator > ( const event& e )const {
+            return std::tie( time, seq ) > std::tie( e.time, e.seq );
+         }
+      };
+
+      bool is_late( uint32_t node )const {
+         return node >= opts.nodes - opts.late_nodes;
+      }
+
+      void connect( uint32_t a, uint32_t b ) {
+         if( a == b || nodes[a].links.count( b ) )
+            return;
+         std::uniform_int_distribution<sim_time> spread( 0, sim_time( opts.latency_spread_ms ) * 1000 );
+         sim_time latency = sim_time( opts.latency_ms ) * 1000 + spread( rng );
+         nodes[a].links[b] = std::make_shared<peer_link>( b, latency );
+         nodes[b].links[a] = std::make_shared<peer_link>( a, latency );
+         link_count += 2;
+      }
+
+      void schedule( sim_time t, std::function<void(sim_time)> action ) {
+         events.push( event{ t, next_seq++, std::move(action) } );
+      }
+
+      /// real time f takes
+      template<typename F>
+      static sim_time measure( uint64_t& cpu_us, F&& f ) {
+         auto begin = std::chrono::steady_clock::now();
+         f();
+         auto used = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - begin ).count();
+         cpu_us += used;
+         return used;
+      }
+
+      /// runs f as the node's next piece of work, which keeps the node busy for as long as f takes
+      template<typename F>
+      sim_time process( uint32_t node, sim_time now, uint64_t& cpu_us, F&& f ) {
+         auto& n = nodes[node];
+         n.busy_until = std::max( now, n.busy_until ) + measure( cpu_us, std::forward<F>(f) );
+         return n.busy_until;
+      }
+
+      /// queues buffer to the peer of link at time t, like connection::enqueue
+      void send( uint32_t node, const link_ptr& link, const std::shared_ptr<vector<char>>& buffer, send_priority priority,
+                 traffic_kind kind, sim_time t ) {
+         schedule( t, [this, node, link, buffer, priority, kind]( sim_time now ) {
+            enqueue( node, link, buffer, priority, kind, now );
+         });
+      }
+
+      void enqueue( uint32_t node, const link_ptr& link, const std::shared_ptr<vector<char>>& buffer, send_priority priority,
+                    traffic_kind kind, sim_time now ) {
+         if( !nodes[link->peer].online )
+            return;
+         link->write_queues.push( priority, queued_write{ buffer, kind } );
+         if( !link->writing )
+            start_write( node, link, now );
+      }
+
+      /// puts the next batch of the send queues on the wire, like connection::do_queue_write
+      void start_write( uint32_t node, const link_ptr& link, sim_time now ) {
+         std::deque<queued_write> batch;
+         link->write_queues.next_batch( batch );
+         if( batch.empty() )
+            return;
+         link->writing = true;
+
+         std::uniform_int_distribution<sim_time> jitter( 0, sim_time( opts.jitter_ms ) * 1000 );
+         std::uniform_real_distribution<double> lost( 0, 1 );
+         sim_time sent = now;
+         for( const auto& w : batch ) {
+            sent += opts.bandwidth_mbps ? sim_time( w.buff->size() ) * 8 / opts.bandwidth_mbps : 0;
+            sim_time arrival = sent + link->latency + jitter( rng );
+            while( lost( rng ) < opts.loss ) {
+               arrival += sim_time( opts.retransmit_ms ) * 1000;
+            }
+            arrival = std::max( arrival, link->last_arrival );
+            link->last_arrival = arrival;
+            traffic[w.kind] += w.buff->size();
+
+            schedule( arrival, [this, node, to = link->peer, buffer = w.buff, now]( sim_time at ) { receive( to, node, buffer, now, at ); } );
+         }
+         schedule( sent, [this, node, link]( sim_time at ) {
+            link->writing = false;
+            enqueue_sync_block( node, link, at );
+            if( !link->writing )
+               start_write( node, link, at );
+         });
+      }
+
+      /// queues the next block of the range the peer requested, like connection::enqueue_sync_block
+      bool enqueue_sync_block( uint32_t node, const link_ptr& link, sim_time now ) {
+         if( link->sync_end == 0 )
+            return false;
+         if( link->compressing_sync_block )
+            return true;
+         auto b = nodes[node].chain->control->fetch_block_by_number( link->sync_next );
+         if( !b )
+            return false;
+         if( link->sync_next++ == link->sync_end )
+            link->sync_end = 0;
+         if( !opts.sync_compression ) {
+            enqueue( node, link, create_send_buffer( *b ), sync_priority, sync_traffic, now );
+            return true;
+         }
+         link->compressing_sync_block = true;
+         std::shared_ptr<vector<char>> buffer;
+         auto used = measure( compress_cpu_us, [&]() { buffer = create_sync_block_buffer( *b, opts.sync_compression_min_size ); } );
+         auto generation = link->flush_generation;
+         schedule( now + used, [this, node, link, buffer, generation]( sim_time at ) {
+            if( link->flush_generation != generation )
+               return;
+            link->compressing_sync_block = false;
+            enqueue( node, link, buffer, sync_priority, sync_traffic, at );
+         });
+         return true;
+      }
+
+      void produce_block( sim_time now ) {
+         for( auto& other : nodes )
+            other.req_trx.erase_expired( to_time_point_sec( now ) );
+         auto& n = nodes[0];
+         signed_block_ptr b;
+         auto done = process( 0, now, produce_cpu_us, [&]() { b = n.chain->produce_block(); } );
+         ++produced_blocks;
+         included_trxs += b->transactions.size();
+         n.known_blocks.insert( b->id() );
+         produced_at[b->id()] = done;
+         block_latencies[b->id()];
+         bcast_block( 0, b, done );
+      }
+
+      void originate_transaction( uint32_t origin, sim_time now ) {
+         auto& chain = *nodes[origin].chain;
+         signed_transaction trx;
+         newaccount act;
+         act.creator = config::system_account_name;
+         act.name    = next_account_name();
+         act.owner   = authority( account_key );
+         act.active  = authority( account_key );
+         trx.actions.emplace_back( vector<permission_level>{{config::system_account_name, config::active_name}}, act );
+         chain.set_transaction_headers( trx );
+         trx.sign( eosio_key, chain.control->get_chain_id() );
+         ++sent_trxs;
+         packed_transaction ptrx( trx );
+         recv_transaction( origin, link_ptr(), ptrx, now );
+      }
+
+      account_name next_account_name() {
+         static const char* chars = "12345abcdefghijklmnopqrstuvwxyz";
+         string s = "sim";
+         for( uint32_t i = 0, n = next_account++; i < 7; ++i, n /= 31 ) {
+            s += chars[n % 31];
+         }
+         return account_name( s );
+      }
+
+      void join_late_nodes( sim_time now ) {
+         for( uint32_t i = opts.nodes - opts.late_nodes; i < opts.nodes; ++i ) {
+            nodes[i].online = true;
+         }
+         for( uint32_t i = opts.nodes - opts.late_nodes; i < opts.nodes; ++i ) {
+            // what the handshakes with its peers tell it
+            uint32_t target = 0;
+            for( const auto& l : nodes[i].links ) {
+               if( !is_late( l.first ) )
+                  target = std::max( target, nodes[l.first].chain->control->head_block_num() );
+            }
+            start_sync( i, target, now );
+         }
+      }
+
+      /// decodes buffer, written at sent, beside the main thread, then hands it to the node
+      void receive( uint32_t node, uint32_t from, const std::shared_ptr<vector<char>>& buffer, sim_time sent, sim_time now ) {
+         auto& n = nodes[node];
+         if( !n.online )
+            return;
+         auto link = n.links.at( from );
+         // stands in for the time messages net_plugin exchanges, which also see the queueing on the link
+         link->rtt_us = smoothed_round_trip( link->rtt_us, 2 * (now - sent) );
+         auto msg = std::make_shared<net_message>();
+         auto used = measure( decode_cpu_us, [&]() {
+            fc::datastream<const char*> ds( buffer->data() + sizeof(uint32_t), buffer->size() - sizeof(uint32_t) );
+            fc::raw::unpack( ds, *msg );
+            inflate_message( *msg );
+         });
+         ++received_messages;
+         schedule( now + used, [this, node, link, msg]( sim_time at ) { handle_message( node, link, *msg, at ); } );
+      }
+
+      void handle_message( uint32_t node, const link_ptr& link, net_message& msg, sim_time now ) {
+         if( msg.contains<signed_block>() ) {
+            recv_block( node, link, std::make_shared<signed_block>( std::move( msg.get<signed_block>() ) ), now );
+         } else if( msg.contains<packed_transaction>() ) {
+            recv_transaction( node, link, msg.get<packed_transaction>(), now );
+         } else if( msg.contains<compact_block_message>() ) {
+            recv_compact_block( node, link, msg.get<compact_block_message>(), now );
+         } else if( msg.contains<block_transactions_request_message>() ) {
+            recv_block_transactions_request( node, link, msg.get<block_transactions_request_message>(), now );
+         } else if( msg.contains<block_transactions_message>() ) {
+            recv_block_transactions( node, link, msg.get<block_transactions_message>(), now );
+         } else if( msg.contains<notice_message>() ) {
+            recv_notice( node, link, msg.get<notice_message>(), now );
+         } else if( msg.contains<request_message>() ) {
+            recv_request( node, link, msg.get<request_message>(), now );
+         } else if( msg.contains<sync_request_message>() ) {
+            recv_sync_request( node, link, msg.get<sync_request_message>(), now );
+         }
+      }
+
+      void recv_block( uint32_t node, const link_ptr& link, const signed_block_ptr& b, sim_time now ) {
+         auto& n = nodes[node];
+         auto id = b->id();
+         auto num = b->block_num();
+         if( n.syncing ) {
+            switch( n.sync.buffer( link, *b, n.sync_next_expected_num, n.sync_last_requested_num ) ) {
+               case sync_ranges<link_ptr>::arrival::apply:
+                  break;
+               case sync_ranges<link_ptr>::arrival::buffered:
+                  chunk_progress( node, link, num, now );
+                  return;
+               case sync_ranges<link_ptr>::arrival::ignored:
+                  ++ignored_sync_blocks;
+                  return;
+            }
+         }
+         n.received_from[id].insert( link->peer );
+         if( num <= n.chain->control->head_block_num() || !n.known_blocks.insert( id ).second ) {
+            ++duplicate_blocks;
+            if( n.syncing )
+               sync_progress( node, link, num, now );
+            return;
+         }
+
+         if( opts.header_relay && !n.syncing ) {
+            bool relay = false;
+            now = process( node, now, header_cpu_us, [&]() {
+               try {
+                  relay = relayable_header( *n.chain->control, *b );
+               } catch( const fc::exception& ) {
+                  // applying it reports the same error
+               }
+            });
+            if( relay ) {
+               n.relayed_blocks.insert( id );
+               bcast_block( node, b, now );
+            }
+         }
+         n.early_blocks[num] = std::make_pair( link, b );
+         apply_blocks( node, now );
+      }
+
+      /// applies the received blocks that link to the node's head, in order, and relays each one
+      void apply_blocks( uint32_t node, sim_time now ) {
+         auto& n = nodes[node];
+         auto next = n.early_blocks.find( n.chain->control->head_block_num() + 1 );
+         while( next != n.early_blocks.end() ) {
+            auto from = next->second.first;
+            auto b = next->second.second;
+            n.early_blocks.erase( next );
+
+            bool applied = false;
+            now = process( node, now, block_cpu_us, [&]() {
+               try {
+                  n.chain->push_block( b );
+                  applied = true;
+               } catch( const fc::exception& ) {
+                  ++rejected_blocks;
+               }
+            });
+            if( !applied )
+               break;
+            ++applied_blocks;
+            n.known_blocks.insert( b->id() );
+
+            if( n.syncing ) {
+               ++synced_blocks;
+               n.received_from.erase( b->id() );
+               sync_progress( node, from, b->block_num(), now );
+               link_ptr source;
+               signed_block_ptr early;
+               if( n.syncing && n.sync.next_early( n.sync_next_expected_num, source, early ) ) {
+                  n.known_blocks.insert( early->id() );
+                  n.early_blocks[early->block_num()] = std::make_pair( source, early );
+               }
+            } else {
+               // the late nodes wait for the sync before their first block, which says nothing about the relay
+               if( !is_late( node ) )
+                  block_latencies[b->id()].push_back( now - produced_at[b->id()] );
+               if( !n.relayed_blocks.erase( b->id() ) )
+                  bcast_block( node, b, now );
+               else
+                  n.received_from.erase( b->id() );
+            }
+
+            next = n.early_blocks.find( n.chain->control->head_block_num() + 1 );
+         }
+      }
+
+      /// sends b to every peer it did not come from, like dispatch_manager::bcast_block
+      void bcast_block( uint32_t node, const signed_block_ptr& b, sim_time now ) {
+         auto& n = nodes[node];
+         auto skip = std::move( n.received_from[b->id()] );
+         n.received_from.erase( b->id() );
+
+         std::shared_ptr<vector<char>> buffer;
+         now = process( node, now, relay_cpu_us, [&]() {
+            if( opts.compact_blocks ) {
+               auto cb = make_compact_block( *b, n.local_txns );
+               if( !cb.compacted.empty() )
+                  buffer = create_send_buffer( cb );
+            }
+            if( !buffer )
+               buffer = create_send_buffer( *b );
+         });
+         for( const auto& l : links_by_latency( node ) ) {
+            if( !skip.count( l->peer ) )
+               send( node, l, buffer, block_priority, block_traffic, now );
+         }
+      }
+
+      void recv_compact_block( uint32_t node, const link_ptr& link, compact_block_message& msg, sim_time now ) {
+         auto& n = nodes[node];
+         ++compact_blocks;
+         auto id = msg.block.id();
+         if( n.known_blocks.count( id ) ) {
+            ++duplicate_blocks;
+            n.received_from[id].insert( link->peer );
+            return;
+         }
+         vector<uint32_t> missing;
+         bool valid = false;
+         now = process( node, now, relay_cpu_us, [&]() {
+            valid = fill_compact_block( msg.block, msg.compacted, n.local_txns, missing );
+         });
+         if( !valid ) {
+            ++rejected_blocks;
+            return;
+         }
+         if( missing.empty() ) {
+            accept_compact_block( node, link, std::move( msg.block ), now );
+            return;
+         }
+         ++incomplete_compact_blocks;
+         missing_trxs += missing.size();
+         send( node, link, create_send_buffer( block_transactions_request_message{ id, missing } ), control_priority, block_traffic, now );
+         auto dropped = link->pending_compact_blocks.add( compact_block_message{ std::move( msg.block ), std::move( missing ) } );
+         if( dropped )
+            request_full_block( node, link, *dropped, now );
+      }
+
+      void accept_compact_block( uint32_t node, const link_ptr& link, signed_block&& b, sim_time now ) {
+         bool matches = false;
+         now = process( node, now, relay_cpu_us, [&]() { matches = matches_transaction_mroot( b ); } );
+         if( !matches ) {
+            request_full_block( node, link, b.id(), now );
+            return;
+         }
+         recv_block( node, link, std::make_shared<signed_block>( std::move( b ) ), now );
+      }
+
+      void request_full_block( uint32_t node, const link_ptr& link, const block_id_type& id, sim_time now ) {
+         ++full_block_requests;
+         request_message req;
+         req.req_blocks.mode = normal;
+         req.req_blocks.ids.push_back( id );
+         send( node, link, create_send_buffer( req ), control_priority, block_traffic, now );
+      }
+
+      void recv_block_transactions_request( uint32_t node, const link_ptr& link, const block_transactions_request_message& msg, sim_time now ) {
+         signed_block_ptr b;
+         try {
+            b = nodes[node].chain->control->fetch_block_by_id( msg.block_id );
+         } catch( const fc::exception& ) {
+         }
+         block_transactions_message reply;
+         reply.block_id = msg.block_id;
+         if( b ) {
+            for( auto i : msg.indices ) {
+               if( i >= b->transactions.size() || !b->transactions[i].trx.contains<packed_transaction>() ) {
+                  reply.trxs.clear();
+                  break;
+               }
+               reply.trxs.push_back( b->transactions[i].trx.get<packed_transaction>() );
+            }
+         }
+         send( node, link, create_send_buffer( reply ), block_priority, block_traffic, now );
+      }
+
+      void recv_block_transactions( uint32_t node, const link_ptr& link, const block_transactions_message& msg, sim_time now ) {
+         auto pending = link->pending_compact_blocks.take( msg.block_id );
+         if( !pending )
+            return;
+         if( !complete_compact_block( *pending, msg ) ) {
+            request_full_block( node, link, msg.block_id, now );
+            return;
+         }
+         accept_compact_block( node, link, std::move( pending->block ), now );
+      }
+
+      void recv_transaction( uint32_t node, const link_ptr& link, packed_transaction& trx, sim_time now ) {
+         auto& n = nodes[node];
+         ++trx_messages;
+         if( n.syncing )
+            return;
+         auto id = trx.id();
+         if( link )
+            link->known_trxs.insert( id );
+         n.req_trx.erase( id );
+         if( n.local_txns.find( id ) ) {
+            ++duplicate_trxs;
+            return;
+         }
+         bool accepted = false;
+         now = process( node, now, trx_cpu_us, [&]() {
+            try {
+               n.chain->push_transaction( trx );
+               accepted = true;
+            } catch( const fc::exception& ) {
+               ++rejected_trxs;
+            }
+         });
+         if( accepted )
+            bcast_transaction( node, trx, now );
+      }
+
+      /// pushes trx or announces its id to every peer not known to have it, like dispatch_manager::bcast_transaction
+      void bcast_transaction( uint32_t node, const packed_transaction& trx, sim_time now ) {
+         auto& n = nodes[node];
+         auto id = trx.id();
+         std::shared_ptr<vector<char>> buffer;
+         now = process( node, now, relay_cpu_us, [&]() { buffer = create_send_buffer( trx ); } );
+         n.local_txns.insert( node_transaction_state{ id, trx.expiration(), trx, buffer, 0 } );
+
+         if( opts.trx_announce_ms == 0 ) {
+            for( const auto& l : links_by_latency( node ) ) {
+               if( nodes[l->peer].syncing || l->known_trxs.contains( id ) )
+                  continue;
+               l->known_trxs.insert( id );
+               send( node, l, buffer, transaction_priority, trx_traffic, now );
+            }
+            return;
+         }
+         for( const auto& l : n.links ) {
+            if( nodes[l.first].syncing || l.second->known_trxs.contains( id ) )
+               continue;
+            l.second->pending_trx_announce.push_back( id );
+            if( l.second->pending_trx_announce.size() >= opts.trx_announce_max_ids )
+               send_trx_announce( node, l.second, now );
+         }
+         if( !n.announce_pending ) {
+            n.announce_pending = true;
+            schedule( now + sim_time( opts.trx_announce_ms ) * 1000, [this, node]( sim_time at ) {
+               nodes[node].announce_pending = false;
+               for( const auto& l : nodes[node].links )
+                  send_trx_announce( node, l.second, at );
+            });
+         }
+      }
+
+      void send_trx_announce( uint32_t node, const link_ptr& link, sim_time now ) {
+         if( link->pending_trx_announce.empty() )
+            return;
+         notice_message note;
+         note.known_blocks.mode = none;
+         note.known_trx.mode = normal;
+         note.known_trx.pending = link->pending_trx_announce.size();
+         note.known_trx.ids = std::move( link->pending_trx_announce );
+         link->pending_trx_announce.clear();
+         send( node, link, create_send_buffer( note ), control_priority, trx_traffic, now );
+      }
+
+      void recv_notice( uint32_t node, const link_ptr& link, const notice_message& msg, sim_time now ) {
+         auto& n = nodes[node];
+         if( n.syncing || msg.known_trx.mode != normal )
+            return;
+         request_message req;
+         req.req_trx.mode = normal;
+         if( !n.req_trx.select( msg.known_trx.ids, n.local_txns, link->known_trxs, to_time_point_sec( now ) + 120, req.req_trx.ids ) )
+            ++ignored_announcements;
+         if( !req.req_trx.ids.empty() )
+            send( node, link, create_send_buffer( req ), control_priority, trx_traffic, now );
+      }
+
+      void recv_request( uint32_t node, const link_ptr& link, const request_message& msg, sim_time now ) {
+         auto& n = nodes[node];
+         if( msg.req_trx.mode == normal ) {
+            for( const auto& id : msg.req_trx.ids ) {
+               auto tx = n.local_txns.find( id );
+               if( tx && tx->serialized_txn ) {
+                  link->known_trxs.insert( id );
+                  send( node, link, tx->serialized_txn, transaction_priority, trx_traffic, now );
+               }
+            }
+         }
+         if( msg.req_blocks.mode == normal ) {
+            for( const auto& id : msg.req_blocks.ids ) {
+               signed_block_ptr b;
+               try {
+                  b = n.chain->control->fetch_block_by_id( id );
+               } catch( const fc::exception& ) {
+               }
+               if( b )
+                  send( node, link, create_send_buffer( *b ), block_priority, block_traffic, now );
+            }
+         }
+      }
+
+      void recv_sync_request( uint32_t node, const link_ptr& link, const sync_request_message& msg, sim_time now ) {
+         if( msg.end_block == 0 ) {
+            // like connection::cancel_sync, which flushes everything queued for the peer
+            link->sync_end = 0;
+            link->write_queues.clear();
+            link->compressing_sync_block = false;
+            ++link->flush_generation;
+            return;
+         }
+         link->sync_next = msg.start_block;
+         link->sync_end = msg.end_block;
+         enqueue_sync_block( node, link, now );
+      }
+
+      void start_sync( uint32_t node, uint32_t target, sim_time now ) {
+         auto& n = nodes[node];
+         uint32_t head = n.chain->control->head_block_num();
+         if( target <= head )
+            return;
+         n.syncing = true;
+         n.sync_started = now;
+         n.sync_known_num = target;
+         n.sync_next_expected_num = head + 1;
+         n.sync_last_requested_num = head;
+         n.sync.clear();
+         request_next_chunk( node, link_ptr(), now );
+      }
+
+      /// the node applied blk_num, received from link while syncing, like the lib catch up part of sync_manager::recv_block
+      void sync_progress( uint32_t node, const link_ptr& link, uint32_t blk_num, sim_time now ) {
+         auto& n = nodes[node];
+         if( blk_num < n.sync_next_expected_num )
+            return;
+         n.sync_next_expected_num = blk_num + 1;
+         if( blk_num >= n.sync_known_num ) {
+            n.syncing = false;
+            n.sync.clear();
+            sync_times.push_back( now - n.sync_started );
+            total_sync_time += now - n.sync_started;
+            return;
+         }
+         chunk_progress( node, link, blk_num, now );
+      }
+
+      void chunk_progress( uint32_t node, const link_ptr& link, uint32_t blk_num, sim_time now ) {
+         auto& n = nodes[node];
+         if( n.sync.advance( link, blk_num ) != sync_ranges<link_ptr>::progress::finished )
+            return;
+         if( auto head = n.sync.takeover( link, opts.sync_span ) ) {
+            send( node, head->source, create_send_buffer( sync_request_message{ 0, 0 } ), control_priority, control_traffic, now );
+            sync_ranges<link_ptr>::assign( *head, head->next, link );
+            request_chunk( node, *head, link, now );
+            return;
+         }
+         request_next_chunk( node, link, now );
+      }
+
+      /// like sync_manager::request_next_chunk
+      void request_next_chunk( uint32_t node, const link_ptr& preferred, sim_time now ) {
+         auto& n = nodes[node];
+         size_t busy = n.sync.schedule( n.sync_next_expected_num, n.sync_last_requested_num, n.sync_known_num,
+                                        opts.sync_span, opts.sync_sources,
+                                        [&]() { return next_sync_source( node, preferred ); },
+                                        [&]( const sync_ranges<link_ptr>::range& r, const link_ptr& source ) {
+                                           request_chunk( node, r, source, now );
+                                        });
+         if( busy == 0 && n.sync_next_expected_num <= n.sync_known_num ) {
+            // net_plugin gives up too, until a handshake starts another sync
+            n.syncing = false;
+            n.sync.clear();
+            ++abandoned_syncs;
+         }
+      }
+
+      void request_chunk( uint32_t node, const sync_ranges<link_ptr>::range& r, const link_ptr& source, sim_time now ) {
+         nodes[node].sync_source = source;
+         send( node, source, create_send_buffer( sync_request_message{ r.next, r.end } ), control_priority, control_traffic, now );
+      }
+
+      /// like sync_manager::next_idle_source: preferred if it is idle, else the idle peer with the shortest round trip
+      link_ptr next_sync_source( uint32_t node, const link_ptr& preferred ) {
+         auto& n = nodes[node];
+         auto idle = [&]( const link_ptr& l ) {
+            return l && nodes[l->peer].online && !nodes[l->peer].syncing && !n.sync.is_source( l );
+         };
+         if( idle( preferred ) )
+            return preferred;
+         auto first = n.sync_source ? n.links.upper_bound( n.sync_source->peer ) : n.links.begin();
+         auto best = fastest_peer( n.links.begin(), first, n.links.end(),
+                                   [&]( const std::pair<const uint32_t, link_ptr>& l ) { return idle( l.second ); },
+                                   []( const std::pair<const uint32_t, link_ptr>& l ) { return l.second->rtt_us; } );
+         return best != n.links.end() ? best->second : link_ptr();
+      }
+
+      /// like net_plugin_impl::connections_by_latency
+      vector<link_ptr> links_by_latency( uint32_t node )const {
+         vector<link_ptr> result;
+         for( const auto& l : nodes[node].links )
+            result.push_back( l.second );
+         sort_by_latency( result, []( const link_ptr& l ) { return l->rtt_us; } );
+         return result;
+      }
+
+      static time_point_sec to_time_point_sec( sim_time t ) {
+         return time_point_sec( uint32_t( t / 1000000 ) );
+      }
+
+      simulation_options                           opts;
+      std::mt19937_64                              rng;
+      vector<node_state>                           nodes;
+      uint32_t                                     link_count = 0;
+      std::priority_queue<event, vector<event>, std::greater<event>> events;
+      uint64_t                                     next_seq = 0;
+
+      private_key_type                             eosio_key;
+      public_key_type                              account_key;
+      uint32_t                                     next_account = 0;
+
+      std::map<block_id_type, sim_time>            produced_at;
+      std::map<block_id_type, vector<sim_time>>    block_latencies; ///< from production to being applied, per node that applied it
+      vector<sim_time>                             sync_times;      ///< from coming online to reaching the head it learned then
+      sim_time                                     total_sync_time = 0;
+
+      std::array<uint64_t, num_traffic_kinds>      traffic{};       ///< bytes put on the links
+      uint64_t produced_blocks = 0;
+      uint64_t included_trxs = 0;
+      uint64_t sent_trxs = 0;
+      uint64_t received_messages = 0;
+      uint64_t applied_blocks = 0;
+      uint64_t synced_blocks = 0;
+      uint64_t ignored_sync_blocks = 0;
+      uint64_t abandoned_syncs = 0;
+      uint64_t ignored_announcements = 0; ///< notices that hit transaction_requests::max_requests
+      uint64_t compact_blocks = 0;
+      uint64_t incomplete_compact_blocks = 0;
+      uint64_t missing_trxs = 0;
+      uint64_t full_block_requests = 0;
+      uint64_t trx_messages = 0;
+      uint64_t duplicate_blocks = 0;
+      uint64_t duplicate_trxs = 0;
+      uint64_t rejected_blocks = 0;
+      uint64_t rejected_trxs = 0;
+      uint64_t produce_cpu_us = 0;
+      uint64_t decode_cpu_us = 0;
+      uint64_t block_cpu_us = 0;
+      uint64_t trx_cpu_us = 0;
+      uint64_t relay_cpu_us = 0;
+      uint64_t header_cpu_us = 0;
+      uint64_t compress_cpu_us = 0;
+   };
+
+}
+
+BOOST_AUTO_TEST_SUITE(net_simulation_tests)
+
+BOOST_AUTO_TEST_CASE(relay_under_load) try {
+   network_simulation sim( parse_options() );
+   sim.run();
+   sim.report( std::cout );
+   BOOST_REQUIRE( sim.all_blocks_delivered() );
+} FC_LOG_AND_RETHROW()
+
+BOOST_AUTO_TEST_SUITE_END()
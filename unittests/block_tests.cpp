@@ -50,4 +50,107 @@ BOOST_AUTO_TEST_CASE(block_with_invalid_tx_test)
   
 }
 
+namespace {
+   /// finalizes the tester's pending block and commits it ahead of its signature
+   block_state_ptr commit_unsigned( tester& chain ) {
+      chain.control->finalize_block();
+      chain.control->commit_block_before_signing();
+      auto bsp = chain.control->unsigned_head_block_state();
+      BOOST_REQUIRE( bsp );
+      return bsp;
+   }
+}
+
+BOOST_AUTO_TEST_CASE(pipelined_signing_emits_once_signed)
+{
+   tester chain;
+   chain.produce_block();
+
+   vector<string> events;
+   vector<block_state_ptr> accepted;
+   chain.control->accepted_block_header.connect( [&]( const block_state_ptr& ) {
+      events.push_back( "header" );
+   });
+   chain.control->accepted_block.connect( [&]( const block_state_ptr& bsp ) {
+      events.push_back( "block" );
+      accepted.push_back( bsp );
+   });
+
+   auto bsp = commit_unsigned( chain );
+   BOOST_CHECK( events.empty() );
+   BOOST_CHECK_EQUAL( chain.control->head_block_id(), bsp->id );
+
+   auto sig = chain.get_private_key( config::system_account_name, "active" ).sign( bsp->sig_digest() );
+   chain.control->complete_block_signature( sig );
+
+   BOOST_REQUIRE_EQUAL( events.size(), 2 );
+   BOOST_CHECK_EQUAL( events[0], "header" );
+   BOOST_CHECK_EQUAL( events[1], "block" );
+   BOOST_REQUIRE_EQUAL( accepted.size(), 1 );
+   BOOST_CHECK( accepted[0]->block->producer_signature == sig );
+   BOOST_CHECK( !chain.control->unsigned_head_block_state() );
+
+   auto b = chain.control->fetch_block_by_number( bsp->block_num );
+   BOOST_REQUIRE( b );
+   BOOST_CHECK( b->producer_signature == sig );
+
+   // the chain goes on as usual
+   chain.produce_block();
+   BOOST_CHECK_EQUAL( chain.control->head_block_num(), bsp->block_num + 1 );
+}
+
+BOOST_AUTO_TEST_CASE(pipelined_signing_rejects_wrong_key)
+{
+   tester chain;
+   chain.produce_block();
+
+   auto bsp = commit_unsigned( chain );
+   auto wrong = chain.get_private_key( N(someone), "active" ).sign( bsp->sig_digest() );
+   BOOST_CHECK_THROW( chain.control->complete_block_signature( wrong ), wrong_signing_key );
+   BOOST_CHECK( chain.control->unsigned_head_block_state() == bsp );
+
+   chain.control->complete_block_signature( chain.get_private_key( config::system_account_name, "active" ).sign( bsp->sig_digest() ) );
+   BOOST_CHECK( !chain.control->unsigned_head_block_state() );
+}
+
+BOOST_AUTO_TEST_CASE(pipelined_signing_discard_restores_head)
+{
+   tester chain;
+   chain.produce_block();
+   auto prev_head = chain.control->head_block_id();
+   auto prev_fork_db_head = chain.control->fork_db_head_block_id();
+
+   auto bsp = commit_unsigned( chain );
+   chain.control->discard_unsigned_block();
+
+   BOOST_CHECK( !chain.control->unsigned_head_block_state() );
+   BOOST_CHECK_EQUAL( chain.control->head_block_id(), prev_head );
+   BOOST_CHECK_EQUAL( chain.control->fork_db_head_block_id(), prev_fork_db_head );
+   BOOST_CHECK( !chain.control->fetch_block_state_by_id( bsp->id ) );
+
+   chain.produce_block();
+   BOOST_CHECK_EQUAL( chain.control->head_block_num(), bsp->block_num );
+}
+
+BOOST_AUTO_TEST_CASE(pipelined_signing_blocks_other_blocks)
+{
+   tester chain;
+   auto signed_block = chain.produce_block();
+
+   auto bsp = commit_unsigned( chain );
+   // unsigned blocks are not handed out
+   BOOST_CHECK( !chain.control->fetch_block_by_number( bsp->block_num ) );
+   BOOST_CHECK( !chain.control->fetch_block_by_id( bsp->id ) );
+   BOOST_CHECK( chain.control->fetch_block_by_number( signed_block->block_num() ) );
+
+   BOOST_CHECK_THROW( chain.control->push_block( signed_block ), block_validate_exception );
+
+   chain.control->start_block( bsp->header.timestamp.next() );
+   BOOST_CHECK_THROW( chain.control->commit_block(), block_validate_exception );
+   BOOST_CHECK( !chain.control->pending_block_state() );
+   BOOST_CHECK( chain.control->unsigned_head_block_state() == bsp );
+
+   chain.control->discard_unsigned_block();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
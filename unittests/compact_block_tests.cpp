@@ -0,0 +1,171 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/net_plugin/relay.hpp>
+#include <eosio/chain/merkle.hpp>
+
+#include <fc/bitutil.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+using namespace eosio;
+
+namespace {
+
+   packed_transaction make_trx( uint16_t ref_block_num ) {
+      signed_transaction trx;
+      trx.ref_block_num = ref_block_num;
+      return packed_transaction( trx );
+   }
+
+   void set_transaction_mroot( signed_block& b ) {
+      vector<digest_type> trx_digests;
+      for( const auto& r : b.transactions )
+         trx_digests.emplace_back( r.digest() );
+      b.transaction_mroot = merkle( std::move(trx_digests) );
+   }
+
+   /// a block of a deferred receipt, which only carries an id, followed by trxs
+   signed_block make_block( uint32_t num, const vector<packed_transaction>& trxs ) {
+      signed_block b;
+      b.previous._hash[0] = fc::endian_reverse_u32( num - 1 );
+      b.transactions.emplace_back( transaction_id_type( digest_type::hash( num ) ) );
+      for( const auto& t : trxs )
+         b.transactions.emplace_back( t );
+      set_transaction_mroot( b );
+      return b;
+   }
+
+   void add( node_transaction_index& local_txns, const packed_transaction& t ) {
+      node_transaction_state nts;
+      nts.id = t.id();
+      nts.expires = time_point_sec( 120 );
+      nts.packed_txn = t;
+      local_txns.insert( std::move(nts) );
+   }
+
+}
+
+BOOST_AUTO_TEST_SUITE(compact_block_tests)
+
+BOOST_AUTO_TEST_CASE(compact_and_rebuild) {
+   auto a = make_trx( 1 ), b = make_trx( 2 ), c = make_trx( 3 );
+   auto blk = make_block( 10, { a, b, c } );
+
+   node_transaction_index sender;
+   add( sender, a );
+   add( sender, b );
+   add( sender, c );
+   auto cb = make_compact_block( blk, sender );
+   BOOST_CHECK( cb.compacted == vector<uint32_t>({ 1, 2, 3 }) );
+   BOOST_CHECK( cb.block.transactions[2].trx.contains<transaction_id_type>() );
+   BOOST_CHECK( !matches_transaction_mroot( cb.block ) );
+
+   // the receiver lacks b and asks for it
+   node_transaction_index receiver;
+   add( receiver, a );
+   add( receiver, c );
+   vector<uint32_t> missing;
+   BOOST_REQUIRE( fill_compact_block( cb.block, cb.compacted, receiver, missing ) );
+   BOOST_CHECK( missing == vector<uint32_t>({ 2 }) );
+
+   compact_block_message pending{ cb.block, missing };
+   BOOST_REQUIRE( complete_compact_block( pending, block_transactions_message{ blk.id(), { b } } ) );
+   BOOST_CHECK( matches_transaction_mroot( pending.block ) );
+   BOOST_CHECK_EQUAL( pending.block.id(), blk.id() );
+}
+
+BOOST_AUTO_TEST_CASE(only_known_transactions_are_compacted) {
+   auto a = make_trx( 1 ), b = make_trx( 2 );
+   auto blk = make_block( 10, { a, b } );
+
+   node_transaction_index sender;
+   add( sender, b );
+   auto cb = make_compact_block( blk, sender );
+   BOOST_CHECK( cb.compacted == vector<uint32_t>({ 2 }) );
+   BOOST_CHECK( cb.block.transactions[1].trx.contains<packed_transaction>() );
+}
+
+BOOST_AUTO_TEST_CASE(invalid_indices_are_rejected) {
+   auto a = make_trx( 1 );
+   auto blk = make_block( 10, { a } );
+   node_transaction_index local_txns;
+   add( local_txns, a );
+   auto cb = make_compact_block( blk, local_txns );
+
+   vector<uint32_t> missing;
+   // past the end of the block
+   BOOST_CHECK( !fill_compact_block( cb.block, { 2 }, local_txns, missing ) );
+   // a receipt that was not compacted
+   auto partial = make_compact_block( blk, node_transaction_index() );
+   BOOST_CHECK( partial.compacted.empty() );
+   BOOST_CHECK( !fill_compact_block( partial.block, { 1 }, local_txns, missing ) );
+   // a duplicate index finds the receipt already filled in
+   BOOST_CHECK( !fill_compact_block( cb.block, { 1, 1 }, local_txns, missing ) );
+}
+
+BOOST_AUTO_TEST_CASE(short_reply_is_rejected) {
+   auto a = make_trx( 1 ), b = make_trx( 2 );
+   auto blk = make_block( 10, { a, b } );
+   node_transaction_index sender;
+   add( sender, a );
+   add( sender, b );
+   auto cb = make_compact_block( blk, sender );
+
+   vector<uint32_t> missing;
+   BOOST_REQUIRE( fill_compact_block( cb.block, cb.compacted, node_transaction_index(), missing ) );
+   BOOST_CHECK_EQUAL( missing.size(), 2u );
+   compact_block_message pending{ cb.block, missing };
+   BOOST_CHECK( !complete_compact_block( pending, block_transactions_message{ blk.id(), { a } } ) );
+   BOOST_CHECK( !complete_compact_block( pending, block_transactions_message{ blk.id(), {} } ) );
+   BOOST_CHECK( pending.block.transactions[1].trx.contains<transaction_id_type>() );
+}
+
+BOOST_AUTO_TEST_CASE(wrong_transaction_fails_mroot) {
+   auto a = make_trx( 1 ), b = make_trx( 2 );
+   auto blk = make_block( 10, { a, b } );
+   node_transaction_index sender;
+   add( sender, a );
+   add( sender, b );
+   auto cb = make_compact_block( blk, sender );
+
+   // a peer answering with another transaction than the one in the block
+   vector<uint32_t> missing;
+   BOOST_REQUIRE( fill_compact_block( cb.block, cb.compacted, node_transaction_index(), missing ) );
+   compact_block_message pending{ cb.block, missing };
+   BOOST_REQUIRE( complete_compact_block( pending, block_transactions_message{ blk.id(), { a, make_trx( 3 ) } } ) );
+   BOOST_CHECK( !matches_transaction_mroot( pending.block ) );
+}
+
+BOOST_AUTO_TEST_CASE(requests_drop_lowest_block) {
+   compact_block_requests requests;
+   vector<block_id_type> ids;
+   for( uint32_t num = 20; num > 20 - compact_block_requests::max_blocks; --num ) {
+      compact_block_message cb{ make_block( num, {} ), {} };
+      ids.push_back( cb.block.id() );
+      BOOST_CHECK( !requests.add( std::move(cb) ) );
+   }
+   BOOST_CHECK_EQUAL( requests.size(), compact_block_requests::max_blocks );
+
+   // adding a block already kept makes no room
+   BOOST_CHECK( !requests.add( compact_block_message{ make_block( 20, {} ), {} } ) );
+
+   compact_block_message cb{ make_block( 30, {} ), {} };
+   auto id = cb.block.id();
+   auto dropped = requests.add( std::move(cb) );
+   BOOST_REQUIRE( dropped );
+   BOOST_CHECK_EQUAL( *dropped, ids.back() );
+   BOOST_CHECK_EQUAL( requests.size(), compact_block_requests::max_blocks );
+   BOOST_CHECK( !requests.take( ids.back() ) );
+
+   auto taken = requests.take( id );
+   BOOST_REQUIRE( taken );
+   BOOST_CHECK_EQUAL( taken->block.block_num(), 30u );
+   BOOST_CHECK( !requests.take( id ) );
+   BOOST_CHECK_EQUAL( requests.size(), compact_block_requests::max_blocks - 1 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -76,6 +76,16 @@ BOOST_FIXTURE_TEST_CASE( delay_error_create_account, validating_tester) { try {
 
    auto scheduled_trxs = control->get_scheduled_transactions();
    BOOST_REQUIRE_EQUAL(scheduled_trxs.size(), 1);
+
+   vector<std::pair<transaction_id_type, account_name>> visited;
+   control->for_each_scheduled_transaction( [&]( const transaction_id_type& id, const account_name& payer ) {
+      visited.emplace_back( id, payer );
+      return true;
+   } );
+   BOOST_REQUIRE_EQUAL(visited.size(), 1);
+   BOOST_REQUIRE(visited.front().first == scheduled_trxs.front());
+   BOOST_REQUIRE_EQUAL(visited.front().second, creator);
+
    auto dtrace = control->push_scheduled_transaction(scheduled_trxs.front(), fc::time_point::maximum());
    BOOST_REQUIRE_EQUAL(dtrace->except.valid(), true);
    BOOST_REQUIRE_EQUAL(dtrace->except->code(), missing_auth_exception::code_value);
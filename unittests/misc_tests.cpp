@@ -4,9 +4,12 @@
  */
 #include <eosio/chain/chain_config.hpp>
 #include <eosio/chain/authority_checker.hpp>
+#include <eosio/chain/apply_context.hpp>
 #include <eosio/chain/authority.hpp>
 #include <eosio/chain/types.hpp>
 #include <eosio/chain/asset.hpp>
+#include <eosio/chain/transaction_arena.hpp>
+#include <eosio/chain/unapplied_transaction_queue.hpp>
 #include <eosio/testing/tester.hpp>
 
 #include <eosio/utilities/key_conversion.hpp>
@@ -645,6 +648,185 @@ BOOST_AUTO_TEST_CASE(transaction_test) { try {
 
 } FC_LOG_AND_RETHROW() }
 
+BOOST_AUTO_TEST_CASE(transaction_arena_test) { try {
+   transaction_arena arena;
+
+   {
+      vector<uint64_t, arena_allocator<uint64_t>> v(arena);
+      for( uint64_t i = 0; i < 100000; ++i )
+         v.push_back(i);
+      BOOST_CHECK_EQUAL(v[4242], 4242u);
+
+      map<uint64_t, uint64_t, std::less<uint64_t>, arena_allocator<std::pair<const uint64_t, uint64_t>>> m(arena);
+      for( uint64_t i = 0; i < 1000; ++i )
+         m[i] = i * 2;
+      BOOST_CHECK_EQUAL(m.size(), 1000u);
+      BOOST_CHECK_EQUAL(m[999], 1998u);
+   }
+   BOOST_CHECK(arena.bytes_allocated() >= 100000 * sizeof(uint64_t));
+
+   // allocations larger than a chunk and over-aligned allocations
+   auto big = arena.allocate(transaction_arena::chunk_size * 3, 8);
+   memset(big, 0, transaction_arena::chunk_size * 3);
+   auto aligned = arena.allocate(1, 64);
+   BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(aligned) % 64, 0u);
+
+   arena.reset();
+   BOOST_CHECK_EQUAL(arena.bytes_allocated(), 0u);
+
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE(iterator_cache_test) { try {
+   struct object {
+      struct { int64_t _id; } id;
+   };
+   // ids that start probing at the same slot of the initial 32, as picked by iterator_cache::slot_for
+   auto colliding_ids = []( size_t count ) {
+      vector<int64_t> ids;
+      for( int64_t id = 1; ids.size() < count; ++id ) {
+         if( ( (uint64_t(id) * 0x9E3779B97F4A7C15ull) >> 32 & 31 ) == ( (0x9E3779B97F4A7C15ull >> 32) & 31 ) )
+            ids.push_back( id );
+      }
+      return ids;
+   };
+
+   transaction_arena arena;
+   {
+      apply_context::iterator_cache<object> cache( arena );
+      auto ids = colliding_ids( 4 );
+      BOOST_REQUIRE_EQUAL( ids[0], 1 );
+      vector<object> objs;
+      for( auto id : ids )
+         objs.push_back( object{ { id } } );
+
+      // repeated finds of an object yield the same iterator
+      int a = cache.add( objs[0] ), b = cache.add( objs[1] ), c = cache.add( objs[2] );
+      BOOST_CHECK_EQUAL( cache.add( objs[1] ), b );
+      BOOST_CHECK_EQUAL( cache.add( objs[2] ), c );
+      BOOST_CHECK_EQUAL( &cache.get( c ), &objs[2] );
+
+      // b and c are found past the slot a leaves behind
+      cache.remove( a );
+      BOOST_CHECK_THROW( cache.get( a ), table_operation_not_permitted );
+      BOOST_CHECK_EQUAL( cache.add( objs[1] ), b );
+      BOOST_CHECK_EQUAL( cache.add( objs[2] ), c );
+
+      // a new object takes the freed slot but not the iterator, so does a again
+      int d = cache.add( objs[3] );
+      BOOST_CHECK( d != a && d != b && d != c );
+      int a2 = cache.add( objs[0] );
+      BOOST_CHECK( a2 != a && a2 != d );
+      BOOST_CHECK_EQUAL( cache.add( objs[2] ), c );
+      BOOST_CHECK_EQUAL( cache.add( objs[3] ), d );
+      BOOST_CHECK_THROW( cache.get( a ), table_operation_not_permitted );
+
+      // removing the middle of the chain leaves the rest reachable
+      cache.remove( b );
+      cache.remove( b );
+      BOOST_CHECK_EQUAL( cache.add( objs[2] ), c );
+      BOOST_CHECK_EQUAL( cache.add( objs[0] ), a2 );
+   }
+   {
+      // 32 slots are rebuilt once a 25th would be used; freed slots count as used until then
+      apply_context::iterator_cache<object> cache( arena );
+      vector<object> objs;
+      for( int64_t id = 0; id < 200; ++id )
+         objs.push_back( object{ { id } } );
+      vector<int> itrs;
+      for( size_t i = 0; i < 24; ++i )
+         itrs.push_back( cache.add( objs[i] ) );
+      for( size_t i = 0; i < 24; i += 2 )
+         cache.remove( itrs[i] );
+      for( size_t i = 24; i < objs.size(); ++i )
+         itrs.push_back( cache.add( objs[i] ) );
+
+      for( size_t i = 0; i < objs.size(); ++i ) {
+         if( i < 24 && i % 2 == 0 ) {
+            BOOST_CHECK_THROW( cache.get( itrs[i] ), table_operation_not_permitted );
+         } else {
+            BOOST_CHECK_EQUAL( cache.add( objs[i] ), itrs[i] );
+            BOOST_CHECK_EQUAL( &cache.get( itrs[i] ), &objs[i] );
+         }
+      }
+   }
+
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE(unapplied_transaction_queue_test) { try {
+   auto make_trx = []( uint32_t expiration, uint16_t nonce ) {
+      signed_transaction trx;
+      trx.expiration    = fc::time_point_sec( expiration );
+      trx.ref_block_num = nonce;
+      return std::make_shared<transaction_metadata>( trx );
+   };
+
+   unapplied_transaction_queue q;
+   vector<transaction_metadata_ptr> trxs;
+   for( uint16_t i = 0; i < 5; ++i ) {
+      trxs.push_back( make_trx( 100 - i, i ) );
+      BOOST_REQUIRE( q.add( trxs.back() ) );
+   }
+   BOOST_REQUIRE( !q.add( trxs[0] ) ); // keeps its original arrival
+   BOOST_REQUIRE_EQUAL( q.size(), 5 );
+
+   // iterated in arrival order, entries can be erased while iterating past them
+   size_t n = 0;
+   for( auto itr = q.begin(); itr != q.end(); ) {
+      auto trx = (itr++)->trx_meta;
+      BOOST_REQUIRE( trx == trxs[n++] );
+      if( trx == trxs[2] ) q.erase( trx->signed_id );
+   }
+   BOOST_REQUIRE_EQUAL( n, 5 );
+   BOOST_REQUIRE_EQUAL( q.size(), 4 );
+
+   BOOST_REQUIRE( q.find( trxs[1]->id ) == trxs[1] );
+   BOOST_REQUIRE( !q.find( trxs[2]->id ) );
+
+   // trxs[3] and trxs[4] expire before 98
+   BOOST_REQUIRE_EQUAL( q.erase_expired( fc::time_point_sec(98) ), 2 );
+   BOOST_REQUIRE_EQUAL( q.size(), 2 );
+   BOOST_REQUIRE( q.begin()->trx_meta == trxs[0] );
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE(unapplied_transaction_queue_duplicates) { try {
+   auto make_trx = []( uint32_t expiration, uint16_t nonce ) {
+      signed_transaction trx;
+      trx.expiration    = fc::time_point_sec( expiration );
+      trx.ref_block_num = nonce;
+      return trx;
+   };
+
+   unapplied_transaction_queue q;
+   auto first  = std::make_shared<transaction_metadata>( make_trx( 100, 1 ) );
+   auto second = std::make_shared<transaction_metadata>( make_trx( 50, 2 ) );
+   BOOST_REQUIRE( q.add( first ) );
+   BOOST_REQUIRE( q.add( second ) );
+
+   // the same transaction unapplied again by another block keeps the entry queued first
+   auto again = std::make_shared<transaction_metadata>( make_trx( 100, 1 ) );
+   BOOST_REQUIRE( again != first && again->signed_id == first->signed_id );
+   BOOST_REQUIRE( !q.add( again ) );
+   BOOST_REQUIRE_EQUAL( q.size(), 2 );
+   BOOST_REQUIRE( q.find( first->id ) == first );
+   BOOST_REQUIRE( q.begin()->trx_meta == first );
+   BOOST_REQUIRE( q.begin()->expiry == fc::time_point( fc::time_point_sec( 100 ) ) );
+
+   // arrival, not expiry, orders iteration; a transaction dropped and unapplied again goes to the back
+   BOOST_REQUIRE( q.erase( first->signed_id ) );
+   BOOST_REQUIRE( !q.erase( first->signed_id ) );
+   BOOST_REQUIRE( q.add( again ) );
+   vector<transaction_metadata_ptr> order;
+   for( const auto& entry : q )
+      order.push_back( entry.trx_meta );
+   BOOST_REQUIRE_EQUAL( order.size(), 2 );
+   BOOST_REQUIRE( order[0] == second );
+   BOOST_REQUIRE( order[1] == again );
+
+   q.clear();
+   BOOST_REQUIRE( q.empty() );
+   BOOST_REQUIRE( !q.find( again->id ) );
+} FC_LOG_AND_RETHROW() }
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace eosio
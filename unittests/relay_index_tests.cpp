@@ -0,0 +1,105 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/net_plugin/relay.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace eosio;
+
+namespace {
+
+   transaction_id_type make_id( uint32_t n ) {
+      return transaction_id_type::hash( n );
+   }
+
+   void add( node_transaction_index& txns, uint32_t n, uint32_t expires ) {
+      node_transaction_state nts;
+      nts.id = make_id( n );
+      nts.expires = time_point_sec( expires );
+      txns.insert( std::move(nts) );
+   }
+
+   uint32_t count_contained( const peer_txn_filter& filter, uint32_t first, uint32_t last ) {
+      uint32_t n = 0;
+      for( uint32_t i = first; i < last; ++i ) {
+         n += filter.contains( make_id( i ) );
+      }
+      return n;
+   }
+
+}
+
+BOOST_AUTO_TEST_SUITE(relay_index_tests)
+
+BOOST_AUTO_TEST_CASE(expired_buckets_are_dropped) {
+   node_transaction_index txns;
+   add( txns, 1, 10 );
+   add( txns, 2, 20 );
+   add( txns, 3, 20 );
+   add( txns, 4, 30 );
+   BOOST_CHECK_EQUAL( txns.size(), 4u );
+
+   // a second insert of an id keeps the first entry and its expiry
+   add( txns, 4, 15 );
+   BOOST_CHECK_EQUAL( txns.size(), 4u );
+
+   txns.erase_expired( time_point_sec( 9 ) );
+   BOOST_CHECK_EQUAL( txns.size(), 4u );
+   txns.erase_expired( time_point_sec( 20 ) );
+   BOOST_CHECK_EQUAL( txns.size(), 1u );
+   BOOST_CHECK( txns.find( make_id( 4 ) ) );
+   txns.erase_expired( time_point_sec( 30 ) );
+   BOOST_CHECK_EQUAL( txns.size(), 0u );
+}
+
+BOOST_AUTO_TEST_CASE(included_entry_follows_its_last_block) {
+   node_transaction_index txns;
+   add( txns, 1, 100 );
+   add( txns, 2, 100 );
+   txns.set_block_num( make_id( 1 ), 5 );
+   txns.set_block_num( make_id( 2 ), 5 );
+
+   // a fork switch includes 1 in a later block
+   txns.set_block_num( make_id( 1 ), 8 );
+   txns.erase_included( 5 );
+   BOOST_CHECK( !txns.find( make_id( 2 ) ) );
+   BOOST_REQUIRE( txns.find( make_id( 1 ) ) );
+   BOOST_CHECK_EQUAL( txns.find( make_id( 1 ) )->block_num, 8u );
+
+   txns.erase_included( 8 );
+   BOOST_CHECK_EQUAL( txns.size(), 0u );
+
+   // the expiry bucket of an entry already erased is dropped without effect
+   add( txns, 3, 200 );
+   txns.erase_expired( time_point_sec( 100 ) );
+   BOOST_CHECK_EQUAL( txns.size(), 1u );
+}
+
+BOOST_AUTO_TEST_CASE(filter_keeps_two_generations) {
+   peer_txn_filter filter;
+   for( uint32_t i = 0; i < peer_txn_filter_capacity; ++i ) {
+      filter.insert( make_id( i ) );
+   }
+   BOOST_CHECK_EQUAL( count_contained( filter, 0, peer_txn_filter_capacity ), peer_txn_filter_capacity );
+
+   // the next id starts a generation, the full one is still consulted
+   filter.insert( make_id( peer_txn_filter_capacity ) );
+   BOOST_CHECK( filter.contains( make_id( peer_txn_filter_capacity ) ) );
+   BOOST_CHECK_EQUAL( count_contained( filter, 0, peer_txn_filter_capacity ), peer_txn_filter_capacity );
+
+   // once that generation is full too, the first one is gone but for false positives; an id taken for a
+   // false positive is not counted, so a generation may take a few more ids than its capacity
+   const uint32_t last = 2 * peer_txn_filter_capacity + 100;
+   for( uint32_t i = peer_txn_filter_capacity + 1; i < last; ++i ) {
+      filter.insert( make_id( i ) );
+   }
+   BOOST_CHECK_EQUAL( count_contained( filter, last - peer_txn_filter_capacity, last ), peer_txn_filter_capacity );
+   BOOST_CHECK_LT( count_contained( filter, 0, peer_txn_filter_capacity ), peer_txn_filter_capacity / 100 );
+
+   filter.clear();
+   BOOST_CHECK_EQUAL( count_contained( filter, 0, last ), 0u );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,145 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/net_plugin/relay.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace eosio;
+
+namespace {
+
+   struct queued {
+      std::shared_ptr<vector<char>> buff;
+      std::string                   name;
+   };
+
+   void push( send_queues<queued>& q, send_priority p, const std::string& name, size_t size ) {
+      q.push( p, queued{ std::make_shared<vector<char>>( size ), name } );
+   }
+
+   std::vector<std::string> names( const std::deque<queued>& batch ) {
+      std::vector<std::string> result;
+      for( const auto& w : batch ) {
+         result.push_back( w.name );
+      }
+      return result;
+   }
+
+   size_t count( const std::deque<queued>& batch, char prefix ) {
+      size_t n = 0;
+      for( const auto& w : batch ) {
+         n += w.name[0] == prefix;
+      }
+      return n;
+   }
+
+}
+
+BOOST_AUTO_TEST_SUITE(send_queues_tests)
+
+BOOST_AUTO_TEST_CASE(control_first_then_by_priority) {
+   send_queues<queued> q;
+   push( q, sync_priority, "s1", 100 );
+   push( q, transaction_priority, "t1", 100 );
+   push( q, block_priority, "b1", 100 );
+   push( q, control_priority, "c1", 10 );
+   push( q, block_priority, "b2", 100 );
+   push( q, control_priority, "c2", 10 );
+   BOOST_CHECK_EQUAL( q.size(), 6u );
+
+   std::deque<queued> batch;
+   BOOST_CHECK_EQUAL( q.next_batch( batch ), 420u );
+   std::vector<std::string> expected{ "c1", "c2", "b1", "b2", "t1", "s1" };
+   BOOST_CHECK( names( batch ) == expected );
+   BOOST_CHECK( q.empty() );
+}
+
+BOOST_AUTO_TEST_CASE(rounds_share_by_weight) {
+   send_queues<queued> q;
+   for( int i = 0; i < 4; ++i ) {
+      push( q, block_priority, "b", 64*1024 );
+      push( q, transaction_priority, "t", 32*1024 );
+   }
+   for( int i = 0; i < 2; ++i ) {
+      push( q, sync_priority, "s", 16*1024 );
+   }
+
+   // each round grants block 8, transaction 4 and sync 1 quantum of 16KiB
+   std::deque<queued> batch;
+   BOOST_CHECK_EQUAL( q.next_batch( batch ), 416u*1024 );
+   std::vector<std::string> expected{ "b", "b", "t", "t", "s", "b", "b", "t", "t", "s" };
+   BOOST_CHECK( names( batch ) == expected );
+   BOOST_CHECK( q.empty() );
+}
+
+BOOST_AUTO_TEST_CASE(batch_stops_after_max_write_batch) {
+   send_queues<queued> q;
+   for( int i = 0; i < 10; ++i ) {
+      push( q, block_priority, "b", 64*1024 );
+      push( q, transaction_priority, "t", 32*1024 );
+      push( q, sync_priority, "s", 16*1024 );
+   }
+
+   // the round that reaches max_write_batch is the last one
+   std::deque<queued> batch;
+   auto size = q.next_batch( batch );
+   BOOST_CHECK_GE( size, max_write_batch );
+   BOOST_CHECK_EQUAL( size, 416u*1024 );
+   BOOST_CHECK_EQUAL( count( batch, 'b' ), 4u );
+   BOOST_CHECK_EQUAL( count( batch, 't' ), 4u );
+   BOOST_CHECK_EQUAL( count( batch, 's' ), 2u );
+   BOOST_CHECK_EQUAL( q.size(), 20u );
+
+   // what is left goes in the next writes
+   batch.clear();
+   q.next_batch( batch );
+   BOOST_CHECK_EQUAL( count( batch, 'b' ), 4u );
+}
+
+BOOST_AUTO_TEST_CASE(message_larger_than_a_quantum) {
+   send_queues<queued> q;
+   push( q, sync_priority, "s", 40*1024 );
+
+   // banks quanta over several rounds of the same write
+   std::deque<queued> batch;
+   BOOST_CHECK_EQUAL( q.next_batch( batch ), 40u*1024 );
+   BOOST_CHECK_EQUAL( batch.size(), 1u );
+   BOOST_CHECK( q.empty() );
+}
+
+BOOST_AUTO_TEST_CASE(large_message_is_not_starved) {
+   send_queues<queued> q;
+   push( q, block_priority, "b", 300*1024 );
+   for( int i = 0; i < 200; ++i ) {
+      push( q, transaction_priority, "t", 1024 );
+   }
+
+   // the block needs three rounds of credit; the transactions keep their share meanwhile
+   std::deque<queued> batch;
+   BOOST_CHECK_EQUAL( q.next_batch( batch ), 492u*1024 );
+   BOOST_CHECK_EQUAL( count( batch, 'b' ), 1u );
+   BOOST_CHECK_EQUAL( count( batch, 't' ), 192u );
+   BOOST_CHECK_EQUAL( batch[128].name, "b" );
+   BOOST_CHECK_EQUAL( q.size(), 8u );
+}
+
+BOOST_AUTO_TEST_CASE(clear_drops_queues_and_credit) {
+   send_queues<queued> q;
+   push( q, block_priority, "b", 300*1024 );
+   push( q, control_priority, "c", 10 );
+   q.clear();
+   BOOST_CHECK( q.empty() );
+
+   std::deque<queued> batch;
+   BOOST_CHECK_EQUAL( q.next_batch( batch ), 0u );
+   BOOST_CHECK( batch.empty() );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,84 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/producer_plugin/subjective_billing.hpp>
+#include <eosio/testing/tester.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace eosio;
+using namespace eosio::chain;
+using namespace eosio::testing;
+
+BOOST_AUTO_TEST_SUITE(subjective_billing_tests)
+
+BOOST_AUTO_TEST_CASE(bill_decays_over_the_window) {
+   subjective_billing sub;
+   const auto t0 = fc::time_point::from_iso_string( "2020-01-01T00:00:00" );
+   BOOST_CHECK_EQUAL( sub.get_subjective_bill( N(alice), t0 ), 0 );
+
+   sub.bill( N(alice), fc::microseconds( 1000 ), t0 );
+   sub.bill( N(), fc::microseconds( 1000 ), t0 );
+   sub.bill( N(bob), fc::microseconds( 0 ), t0 );
+   BOOST_CHECK_EQUAL( sub.size(), 1u );
+   BOOST_CHECK_EQUAL( sub.get_subjective_bill( N(alice), t0 ), 1000 );
+
+   // the same linear decay as resource_limits, half way through the 24 hour window
+   BOOST_CHECK_EQUAL( sub.get_subjective_bill( N(alice), t0 + fc::hours( 12 ) ), 500 );
+   BOOST_CHECK_EQUAL( sub.get_subjective_bill( N(alice), t0 ), 1000 );
+   sub.bill( N(alice), fc::microseconds( 1000 ), t0 + fc::hours( 12 ) );
+   BOOST_CHECK_EQUAL( sub.get_subjective_bill( N(alice), t0 + fc::hours( 12 ) ), 1500 );
+   BOOST_CHECK_EQUAL( sub.get_subjective_bill( N(alice), t0 + fc::hours( 36 ) ), 0 );
+
+   sub.remove_expired( t0 + fc::hours( 36 ) - fc::milliseconds( config::block_interval_ms ) );
+   BOOST_CHECK_EQUAL( sub.size(), 1u );
+   sub.remove_expired( t0 + fc::hours( 36 ) );
+   BOOST_CHECK_EQUAL( sub.size(), 0u );
+
+   sub.disable();
+   sub.bill( N(alice), fc::microseconds( 1000 ), t0 );
+   BOOST_CHECK_EQUAL( sub.size(), 0u );
+   BOOST_CHECK_EQUAL( sub.get_subjective_bill( N(alice), t0 ), 0 );
+}
+
+BOOST_FIXTURE_TEST_CASE(bill_compared_with_available_cpu, tester) try {
+   create_accounts( { N(alice), N(bob), N(carol) } );
+   auto& mgr = control->get_mutable_resource_limits_manager();
+   mgr.set_account_limits( N(alice), -1, -1, 1000 );
+   mgr.set_account_limits( N(bob), -1, -1, 1000000 );
+   produce_blocks( 2 );
+
+   auto available = mgr.get_account_cpu_limit( N(alice) );
+   BOOST_REQUIRE_GT( available, 100 );
+
+   const auto now = control->head_block_time();
+   subjective_billing sub;
+   sub.bill( *control, N(alice), fc::microseconds( available / 2 ), now );
+   BOOST_CHECK( !sub.exceeds_available_cpu( *control, N(alice), now ) );
+   sub.bill( *control, N(alice), fc::microseconds( available ), now );
+   BOOST_CHECK( sub.exceeds_available_cpu( *control, N(alice), now ) );
+
+   // an account without a cpu limit is never over it
+   BOOST_REQUIRE_EQUAL( mgr.get_account_cpu_limit( N(carol) ), -1 );
+   sub.bill( *control, N(carol), fc::microseconds( 10 * available ), now );
+   BOOST_CHECK_GT( sub.get_subjective_bill( N(carol), now ), 0 );
+   BOOST_CHECK( !sub.exceeds_available_cpu( *control, N(carol), now ) );
+
+   // nor is an account that was not billed
+   BOOST_CHECK( !sub.exceeds_available_cpu( *control, N(bob), now ) );
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE(nonexistent_accounts_are_not_billed, tester) try {
+   const auto now = control->head_block_time();
+   subjective_billing sub;
+   sub.bill( *control, N(nobody), fc::microseconds( 1000 ), now );
+   BOOST_CHECK_EQUAL( sub.size(), 0u );
+   BOOST_CHECK( !sub.exceeds_available_cpu( *control, N(nobody), now ) );
+
+   // an account that does not exist has no cpu at all, should it have been billed
+   sub.bill( N(nobody), fc::microseconds( 1000 ), now );
+   BOOST_CHECK( sub.exceeds_available_cpu( *control, N(nobody), now ) );
+} FC_LOG_AND_RETHROW()
+
+BOOST_AUTO_TEST_SUITE_END()
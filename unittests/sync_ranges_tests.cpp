@@ -0,0 +1,177 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/net_plugin/relay.hpp>
+
+#include <fc/bitutil.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <memory>
+#include <vector>
+
+using namespace eosio;
+
+namespace {
+
+   using peer = std::shared_ptr<int>;
+   using ranges = sync_ranges<peer>;
+
+   signed_block make_block( uint32_t num ) {
+      signed_block b;
+      b.previous._hash[0] = fc::endian_reverse_u32( num - 1 );
+      return b;
+   }
+
+   /// hands out the given peers in turn, then no peer
+   struct source_list {
+      std::vector<peer> peers;
+      size_t            next = 0;
+
+      peer operator()() { return next < peers.size() ? peers[next++] : peer(); }
+   };
+
+   struct request {
+      peer     source;
+      uint32_t start;
+      uint32_t end;
+   };
+
+   size_t schedule( ranges& r, uint32_t next_expected, uint32_t& last_requested, uint32_t known,
+                    std::vector<peer> peers, std::vector<request>& requests ) {
+      source_list sources{ std::move(peers) };
+      return r.schedule( next_expected, last_requested, known, 5, 3, sources,
+                         [&]( const ranges::range& rng, const peer& p ) { requests.push_back( request{ p, rng.next, rng.end } ); } );
+   }
+
+   /// delivers blocks first through last of p's range as the source of that range
+   void deliver( ranges& r, const peer& p, uint32_t first, uint32_t last ) {
+      for( uint32_t n = first; n <= last; ++n ) {
+         r.advance( p, n );
+      }
+   }
+
+}
+
+BOOST_AUTO_TEST_SUITE(sync_ranges_tests)
+
+BOOST_AUTO_TEST_CASE(schedule_splits_ranges) {
+   auto a = std::make_shared<int>( 1 ), b = std::make_shared<int>( 2 ), c = std::make_shared<int>( 3 ), d = std::make_shared<int>( 4 );
+   ranges r;
+   uint32_t last_requested = 0;
+   std::vector<request> requests;
+
+   BOOST_CHECK_EQUAL( schedule( r, 1, last_requested, 12, { a, b, c, d }, requests ), 3u );
+   BOOST_REQUIRE_EQUAL( requests.size(), 3u );
+   BOOST_CHECK( requests[0].source == a && requests[0].start == 1 && requests[0].end == 5 );
+   BOOST_CHECK( requests[1].source == b && requests[1].start == 6 && requests[1].end == 10 );
+   BOOST_CHECK( requests[2].source == c && requests[2].start == 11 && requests[2].end == 12 );
+   BOOST_CHECK_EQUAL( last_requested, 12u );
+   BOOST_CHECK( r.is_source( a ) && r.is_source( b ) && r.is_source( c ) && !r.is_source( d ) );
+}
+
+BOOST_AUTO_TEST_CASE(out_of_order_arrival_drains_in_order) {
+   auto a = std::make_shared<int>( 1 ), b = std::make_shared<int>( 2 );
+   ranges r;
+   uint32_t last_requested = 0;
+   std::vector<request> requests;
+   schedule( r, 1, last_requested, 10, { a, b }, requests );
+
+   // b's range arrives before a's
+   for( uint32_t n = 6; n <= 8; ++n ) {
+      BOOST_CHECK( r.buffer( b, make_block( n ), 1, last_requested ) == ranges::arrival::buffered );
+      BOOST_CHECK( r.advance( b, n ) == ranges::progress::ongoing );
+   }
+   peer from;
+   signed_block_ptr blk;
+   BOOST_CHECK( !r.next_early( 2, from, blk ) );
+
+   // a's blocks are applied as they come, the buffered ones follow in order
+   uint32_t next_expected = 1;
+   for( ; next_expected <= 5; ++next_expected ) {
+      BOOST_CHECK( r.buffer( a, make_block( next_expected ), next_expected, last_requested ) == ranges::arrival::apply );
+      r.advance( a, next_expected );
+   }
+   for( ; r.next_early( next_expected, from, blk ); ++next_expected ) {
+      BOOST_CHECK( from == b );
+      BOOST_CHECK_EQUAL( blk->block_num(), next_expected );
+   }
+   BOOST_CHECK_EQUAL( next_expected, 9u );
+}
+
+BOOST_AUTO_TEST_CASE(blocks_from_other_peers_are_ignored) {
+   auto a = std::make_shared<int>( 1 ), b = std::make_shared<int>( 2 ), c = std::make_shared<int>( 3 );
+   ranges r;
+   uint32_t last_requested = 0;
+   std::vector<request> requests;
+   schedule( r, 1, last_requested, 10, { a, b }, requests );
+
+   BOOST_CHECK( r.buffer( c, make_block( 7 ), 1, last_requested ) == ranges::arrival::ignored );
+   BOOST_CHECK( r.buffer( a, make_block( 7 ), 1, last_requested ) == ranges::arrival::ignored );
+   BOOST_CHECK( r.advance( c, 7 ) == ranges::progress::none );
+   BOOST_CHECK( r.advance( a, 7 ) == ranges::progress::none );
+
+   peer from;
+   signed_block_ptr blk;
+   BOOST_CHECK( !r.next_early( 7, from, blk ) );
+}
+
+BOOST_AUTO_TEST_CASE(faster_peer_takes_over) {
+   auto a = std::make_shared<int>( 1 ), b = std::make_shared<int>( 2 ), c = std::make_shared<int>( 3 );
+   ranges r;
+   uint32_t last_requested = 0;
+   std::vector<request> requests;
+   schedule( r, 1, last_requested, 15, { a, b, c }, requests );
+
+   // a is slow: only block 1 of its range arrived while b finished 6 to 10
+   r.advance( a, 1 );
+   BOOST_CHECK( r.takeover( b, 5 ) == nullptr );
+   deliver( r, b, 6, 9 );
+   BOOST_CHECK( r.advance( b, 10 ) == ranges::progress::finished );
+
+   auto head = r.takeover( b, 5 );
+   BOOST_REQUIRE( head != nullptr );
+   BOOST_CHECK( head->source == a );
+   BOOST_CHECK_EQUAL( head->next, 2u );
+   ranges::assign( *head, head->next, b );
+   BOOST_CHECK( !r.is_source( a ) );
+   BOOST_CHECK( r.is_source( b ) );
+
+   // a's late blocks no longer count, b continues where a stopped
+   BOOST_CHECK( r.advance( a, 2 ) == ranges::progress::none );
+   BOOST_CHECK( r.advance( b, 2 ) == ranges::progress::ongoing );
+
+   // a peer that still serves a range does not take over another
+   BOOST_CHECK( r.takeover( c, 5 ) == nullptr );
+}
+
+BOOST_AUTO_TEST_CASE(released_range_is_reassigned) {
+   auto a = std::make_shared<int>( 1 ), b = std::make_shared<int>( 2 ), c = std::make_shared<int>( 3 );
+   ranges r;
+   uint32_t last_requested = 0;
+   std::vector<request> requests;
+   schedule( r, 1, last_requested, 10, { a, b }, requests );
+   deliver( r, a, 1, 3 );
+
+   // a timed out
+   r.release( a );
+   BOOST_CHECK( !r.is_source( a ) );
+   BOOST_CHECK_EQUAL( r.busy(), 1u );
+
+   requests.clear();
+   BOOST_CHECK_EQUAL( schedule( r, 4, last_requested, 10, { c }, requests ), 2u );
+   BOOST_REQUIRE_EQUAL( requests.size(), 1u );
+   BOOST_CHECK( requests[0].source == c );
+   BOOST_CHECK_EQUAL( requests[0].start, 4u );
+   BOOST_CHECK_EQUAL( requests[0].end, 5u );
+   BOOST_CHECK_EQUAL( last_requested, 10u );
+
+   // with nobody to hand it to, a released range waits
+   r.release( c );
+   requests.clear();
+   BOOST_CHECK_EQUAL( schedule( r, 4, last_requested, 10, {}, requests ), 1u );
+   BOOST_CHECK( requests.empty() );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,155 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/producer_plugin/transaction_queue.hpp>
+#include <eosio/chain/name.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using namespace eosio;
+
+namespace {
+
+   struct entry {
+      account_name account;
+      uint32_t     seq = 0;
+   };
+
+   transaction_queue<entry> make_queue( transaction_queue_policy policy, const std::map<account_name, int64_t>& weights = {} ) {
+      return transaction_queue<entry>( policy, [weights]( const account_name& a ) {
+         auto itr = weights.find( a );
+         return itr != weights.end() ? itr->second : int64_t(1);
+      });
+   }
+
+   void push( transaction_queue<entry>& q, account_name a, uint32_t seq, fc::time_point expiration = fc::time_point() ) {
+      q.push_back( entry{ a, seq }, a, expiration );
+   }
+
+   std::vector<account_name> pop_accounts( transaction_queue<entry>& q, size_t count ) {
+      std::vector<account_name> result;
+      while( result.size() < count && !q.empty() )
+         result.push_back( q.pop_front().account );
+      return result;
+   }
+
+}
+
+BOOST_AUTO_TEST_SUITE(transaction_queue_tests)
+
+BOOST_AUTO_TEST_CASE(fifo_keeps_arrival_order) {
+   auto q = make_queue( transaction_queue_policy::fifo );
+   push( q, N(alice), 0 );
+   push( q, N(alice), 1 );
+   push( q, N(bob), 2 );
+   push( q, N(alice), 3 );
+   push( q, N(carol), 4 );
+
+   for( uint32_t i = 0; i < 5; ++i ) {
+      BOOST_REQUIRE_EQUAL( q.pop_front().seq, i );
+   }
+   BOOST_REQUIRE( q.empty() );
+   BOOST_REQUIRE_THROW( q.pop_front(), chain::producer_exception );
+}
+
+BOOST_AUTO_TEST_CASE(earliest_expiry_first) {
+   auto q = make_queue( transaction_queue_policy::earliest_expiry );
+   auto now = fc::time_point::now();
+   push( q, N(alice), 0, now + fc::seconds(30) );
+   push( q, N(bob),   1, now + fc::seconds(10) );
+   push( q, N(alice), 2, now + fc::seconds(20) );
+   push( q, N(carol), 3, now + fc::seconds(10) );
+
+   // equal expirations keep arrival order
+   for( auto expected : { 1, 3, 2, 0 } ) {
+      BOOST_REQUIRE_EQUAL( q.pop_front().seq, expected );
+   }
+}
+
+BOOST_AUTO_TEST_CASE(account_fair_round_robin) {
+   auto q = make_queue( transaction_queue_policy::account_fair );
+   for( uint32_t i = 0; i < 4; ++i ) push( q, N(alice), i );
+   for( uint32_t i = 0; i < 2; ++i ) push( q, N(bob), i );
+   push( q, N(carol), 0 );
+
+   std::vector<account_name> expected = { N(alice), N(bob), N(carol), N(alice), N(bob), N(alice), N(alice) };
+   BOOST_REQUIRE( pop_accounts( q, 7 ) == expected );
+
+   // each account's transactions stay in their own arrival order
+   for( uint32_t i = 0; i < 3; ++i ) push( q, N(alice), i );
+   for( uint32_t i = 0; i < 3; ++i ) {
+      BOOST_REQUIRE_EQUAL( q.pop_front().seq, i );
+   }
+}
+
+BOOST_AUTO_TEST_CASE(cpu_weighted_shares) {
+   auto q = make_queue( transaction_queue_policy::cpu_weighted, { { N(alice), 3000 }, { N(bob), 1000 } } );
+   for( uint32_t i = 0; i < 40; ++i ) {
+      push( q, N(alice), i );
+      push( q, N(bob), i );
+   }
+
+   // while both are queued alice gets three dispatches for each of bob's
+   auto dispatched = pop_accounts( q, 40 );
+   auto alice = std::count( dispatched.begin(), dispatched.end(), N(alice) );
+   BOOST_REQUIRE_EQUAL( alice, 30 );
+
+   // account_fair ignores the weights
+   auto fair = make_queue( transaction_queue_policy::account_fair, { { N(alice), 3000 }, { N(bob), 1000 } } );
+   for( uint32_t i = 0; i < 4; ++i ) {
+      push( fair, N(alice), i );
+      push( fair, N(bob), i );
+   }
+   std::vector<account_name> expected = { N(alice), N(bob), N(alice), N(bob) };
+   BOOST_REQUIRE( pop_accounts( fair, 4 ) == expected );
+}
+
+BOOST_AUTO_TEST_CASE(reactivated_account_banks_no_credit) {
+   auto q = make_queue( transaction_queue_policy::account_fair );
+   for( uint32_t i = 0; i < 6; ++i ) push( q, N(alice), i );
+   pop_accounts( q, 3 );
+
+   // bob starts at the pass of the last dispatch, not at zero, so bob does not get a burst of its own
+   for( uint32_t i = 0; i < 3; ++i ) push( q, N(bob), i );
+   std::vector<account_name> expected = { N(bob), N(alice), N(bob), N(alice), N(bob), N(alice) };
+   BOOST_REQUIRE( pop_accounts( q, 6 ) == expected );
+   BOOST_REQUIRE( q.empty() );
+
+   // an account that emptied its queue comes back level with the others
+   for( uint32_t i = 0; i < 4; ++i ) push( q, N(carol), i );
+   pop_accounts( q, 2 );
+   push( q, N(alice), 0 );
+   expected = { N(alice), N(carol), N(carol) };
+   BOOST_REQUIRE( pop_accounts( q, 3 ) == expected );
+}
+
+BOOST_AUTO_TEST_CASE(extreme_weights) {
+   const int64_t whale = int64_t(1) << 50; // raw stake far above max_weight
+   auto q = make_queue( transaction_queue_policy::cpu_weighted,
+                        { { N(whale), whale }, { N(capped), transaction_queue<entry>::max_weight },
+                          { N(minnow), 1 }, { N(nostake), 0 }, { N(unlimited), -1 } } );
+   for( uint32_t i = 0; i < 100; ++i ) {
+      for( auto a : { N(whale), N(capped), N(minnow), N(nostake), N(unlimited) } )
+         push( q, a, i );
+   }
+
+   // weights above max_weight are clamped, so the pass of the largest accounts still advances
+   auto first = pop_accounts( q, 203 );
+   BOOST_REQUIRE_EQUAL( std::count( first.begin(), first.end(), N(whale) ), 100 );
+   BOOST_REQUIRE_EQUAL( std::count( first.begin(), first.end(), N(capped) ), 100 );
+
+   // accounts without stake share the rest evenly
+   auto rest = pop_accounts( q, 300 );
+   BOOST_REQUIRE_EQUAL( rest.size(), 297u );
+   BOOST_REQUIRE( q.empty() );
+   for( size_t i = 0; i + 3 <= rest.size(); i += 3 ) {
+      BOOST_REQUIRE( rest[i] != rest[i+1] && rest[i+1] != rest[i+2] && rest[i] != rest[i+2] );
+   }
+}
+
+BOOST_AUTO_TEST_SUITE_END()